@@ -0,0 +1,81 @@
+/*    _   _ _ _____ _    _              _____     _ _     ___ ___  _  __
+ *   /_\ | | |_   _| |_ (_)_ _  __ _ __|_   _|_ _| | |__ / __|   \| |/ /
+ *  / _ \| | | | | | ' \| | ' \/ _` (_-< | |/ _` | | / / \__ \ |) | ' <
+ * /_/ \_\_|_| |_| |_||_|_|_||_\__, /__/ |_|\__,_|_|_\_\ |___/___/|_|\_\
+ *                             |___/
+ *
+ * Copyright 2020 AllThingsTalk
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *
+ * WHAT DOES THIS SKETCH DO:
+ * -------------------------
+ * Same as CounterCbor, but setup() doesn't wait for the modem to boot. beginInit() powers it on
+ * and returns, att.loop() connects once the modem answers. In the meantime the sketch keeps
+ * blinking the LED, which it couldn't do while init() waits for the modem.
+ * The counter is only sent once connected, and reset to 1 after reaching 10.
+ * 
+ */
+ 
+#include <AllThingsTalk_LTEM.h>
+#include "keys.h"
+
+#define debugSerial SerialUSB
+#define modemSerial Serial1
+
+// Pin connected to V_INT of the modem, if your board has one (-1 if not).
+// The modem is then only probed once it is powered.
+#define MODEM_VINT_PIN -1
+
+APICredentials credentials(SPACE_ENDPOINT, DEVICE_TOKEN, DEVICE_ID);
+AllThingsTalk_LTEM att(modemSerial, credentials, APN);
+CborPayload payload;
+
+int sendInterval = 5; // Sending interval in seconds
+int counter = 1; // Initial value of counter (resets after reaching 10)
+unsigned long previousMillis;
+unsigned long previousBlink;
+
+void setup() {
+  debugSerial.begin(115200);
+  while (!debugSerial  && millis() < 10000) {}
+  pinMode(LED_BUILTIN, OUTPUT);
+  att.debugPort(debugSerial); // Set port for serialMonitor, true:full debug mode
+  att.setModemVIntPin(MODEM_VINT_PIN);
+  att.beginInit(); // Returns right away, att.loop() finishes connecting
+}
+
+void loop() {  
+  att.loop(); // Powers on the modem, then keeps the network and connection towards AllThingsTalk alive
+  if (millis() - previousBlink > 500) { // Still runs while the modem boots
+    digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
+    previousBlink = millis();
+  }
+  if (att.isInitializing()) {
+    return; // Nothing can be sent yet
+  }
+  if (millis() - previousMillis > sendInterval * 1000) {  // Send message every sendInterval seconds
+    payload.reset();
+    payload.set("counter", counter); // Sends current counter state to "counter" asset on AllThingsTalk
+    debugSerial.print("Counter = ");
+    debugSerial.println(counter);
+    if (att.send(payload)){
+      counter++;
+      if (counter > 10) {
+        counter = 1;
+      }
+    }
+    previousMillis = millis();
+  }
+}
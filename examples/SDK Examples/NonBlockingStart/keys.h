@@ -0,0 +1,14 @@
+#ifndef KEYS_h
+#define KEYS_h
+
+// AllThingsTalk Device Authentication
+char* DEVICE_ID = "yourdeviceid";
+char* DEVICE_TOKEN = "yourdevicetoken";
+
+// Enter APN of your LTE-M Service Provider
+char* APN = "starter.att.iot";
+
+// AllThingsTalk Space Endpoint (leave as is if unfamiliar)
+char* SPACE_ENDPOINT = "api.allthingstalk.io";
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Host-side micro-benchmark of the hex encoding in Sodaq_R4X::writeHex().
+ *
+ * Compares the old per-byte path (two print(char) calls per byte, each going through the
+ * debug mirror check and a virtual Stream::write()) with writeHexChunked() from
+ * src/Sodaq_HexWriter.h, the encoder the driver uses, which writes HEX_WRITE_CHUNK_SIZE
+ * characters at a time. No Arduino core is needed:
+ *
+ *   g++ -O2 -std=c++11 extras/benchmark/hex_write_benchmark.cpp -o hex_write_benchmark
+ *   ./hex_write_benchmark [payload size] [iterations]
+ *
+ * The fake stream only stores the bytes in a ring, so the numbers show the driver's own
+ * overhead, not the UART. Both paths are checked to produce the same output.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../../src/Sodaq_HexWriter.h"
+
+// The old per-byte encoding, as it was in src/Sodaq_R4X.cpp
+#define NIBBLE_TO_HEX_CHAR(i)  ((i <= 9) ? ('0' + i) : ('A' - 10 + i))
+#define HIGH_NIBBLE(i)         ((i >> 4) & 0x0F)
+#define LOW_NIBBLE(i)          (i & 0x0F)
+
+// The part of the Arduino Stream interface the driver writes through.
+class Stream
+{
+public:
+    virtual ~Stream() {}
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+};
+
+// Stores the bytes in a ring, like the transmit buffer of a UART.
+class RingStream : public Stream
+{
+public:
+    RingStream() : head(0) {}
+
+    size_t write(uint8_t value)
+    {
+        ring[head++ % sizeof(ring)] = value;
+        return 1;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size)
+    {
+        for (size_t i = 0; i < size; i++) {
+            ring[head++ % sizeof(ring)] = buffer[i];
+        }
+
+        return size;
+    }
+
+    uint8_t  ring[256];
+    uint32_t head;
+};
+
+// Keeps all the bytes, to check that both paths produce the same output.
+class CaptureStream : public Stream
+{
+public:
+    size_t write(uint8_t value)
+    {
+        data += (char)value;
+        return 1;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size)
+    {
+        data.append((const char*)buffer, size);
+        return size;
+    }
+
+    std::string data;
+};
+
+// The write path of Sodaq_R4X, reduced to what the encoding goes through.
+class Writer
+{
+public:
+    Writer(Stream* modemStream, Stream* diagStream) : _modemStream(modemStream), _diagStream(diagStream) {}
+
+    // As print(char) did: mirror to the diagnostics stream, then write to the modem.
+    size_t print(char value)
+    {
+        if (_diagStream) {
+            _diagStream->write(value);
+        }
+
+        return _modemStream->write(value);
+    }
+
+    size_t writeHexPerByte(const uint8_t* buffer, size_t size)
+    {
+        size_t written = 0;
+
+        for (size_t i = 0; i < size; i++) {
+            written += print(static_cast<char>(NIBBLE_TO_HEX_CHAR(HIGH_NIBBLE(buffer[i]))));
+            written += print(static_cast<char>(NIBBLE_TO_HEX_CHAR(LOW_NIBBLE(buffer[i]))));
+        }
+
+        return written;
+    }
+
+    // What Sodaq_R4X::writeHex() does
+    size_t writeHexChunked(const uint8_t* buffer, size_t size)
+    {
+        return ::writeHexChunked(_modemStream, _diagStream, buffer, size);
+    }
+
+private:
+    Stream* _modemStream;
+    Stream* _diagStream;
+};
+
+typedef size_t (Writer::*WriteHexPtr)(const uint8_t* buffer, size_t size);
+
+// The streams are passed through volatile pointers so the compiler can't devirtualize the writes.
+static RingStream modemStream;
+static RingStream diagStream;
+static Stream* volatile modemStreamPtr = &modemStream;
+static Stream* volatile diagStreamPtr  = &diagStream;
+
+static double run(WriteHexPtr method, bool mirror, const std::vector<uint8_t>& payload, uint32_t iterations)
+{
+    Writer writer(modemStreamPtr, mirror ? diagStreamPtr : NULL);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        (writer.*method)(payload.data(), payload.size());
+    }
+
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char** argv)
+{
+    size_t   size       = (argc > 1) ? strtoul(argv[1], NULL, 10) : 512;
+    uint32_t iterations = (argc > 2) ? strtoul(argv[2], NULL, 10) : 20000;
+
+    std::vector<uint8_t> payload(size);
+
+    for (size_t i = 0; i < size; i++) {
+        payload[i] = (uint8_t)(i * 37 + 11);
+    }
+
+    CaptureStream perByteOutput;
+    CaptureStream chunkedOutput;
+    Writer(&perByteOutput, NULL).writeHexPerByte(payload.data(), payload.size());
+    Writer(&chunkedOutput, NULL).writeHexChunked(payload.data(), payload.size());
+
+    if (perByteOutput.data != chunkedOutput.data) {
+        printf("output differs!\n");
+        return 1;
+    }
+
+    printf("payload %u bytes, %u iterations\n", (unsigned)size, (unsigned)iterations);
+
+    for (int mirror = 0; mirror <= 1; mirror++) {
+        double perByte = run(&Writer::writeHexPerByte, mirror, payload, iterations);
+        double chunked = run(&Writer::writeHexChunked, mirror, payload, iterations);
+
+        printf("%-16s per byte: %8.2f us   chunked: %8.2f us   (%.1fx)\n",
+               mirror ? "debug mirror:" : "no mirror:", perByte, chunked, perByte / chunked);
+    }
+
+    return 0;
+}
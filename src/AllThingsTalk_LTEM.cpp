@@ -41,6 +41,16 @@ template<typename T> void AllThingsTalk_LTEM::debugVerbose(T message, char separ
     }
 }
 
+// Serial print of data that is not NUL terminated (verbose debugging)
+void AllThingsTalk_LTEM::debugVerbose(const char* title, const char* data, size_t length) {
+    if (debugVerboseEnabled && debugSerial) {
+        debugSerial->print(title);
+        debugSerial->print(' ');
+        debugSerial->write((const uint8_t*)data, length);
+        debugSerial->println();
+    }
+}
+
 void AllThingsTalk_LTEM::debugPort(Stream &debugSerial, bool verbose, bool verboseAT) {
     debugVerboseEnabled = verbose;
     this->debugSerial = &debugSerial;
@@ -82,6 +92,10 @@ bool r4x_mqttConnectNetwork() {
     if (r4x.isConnected()) {
         return true;
     } else {
+        // reconnect() takes the shortest way back after a link drop (including a full connect), the first time connect() is needed
+        if (r4x.hasConnectParams()) {
+            return r4x.reconnect();
+        }
         return r4x.connect(r4x_mqtt_APN, URAT, MNOPROF, OPERATOR, M1_BAND_MASK, NB1_BAND_MASK);
     }
 }
@@ -89,21 +103,47 @@ bool r4x_mqttConnectNetwork() {
 //TODO: PINS
 //TODO: LED
 bool AllThingsTalk_LTEM::init() {
+    prepareInit();
+    return connect();
+}
+
+// Same as init(), but returns while the modem boots. loop() connects once it answers.
+void AllThingsTalk_LTEM::beginInit() {
+    prepareInit();
+    debug("Powering on the modem...");
+    r4x.beginPowerOn();
+    poweringOn = true;
+}
+
+bool AllThingsTalk_LTEM::isInitializing() {
+    return poweringOn;
+}
+
+// Lets the power-on skip probing the modem until its V_INT pin is high, see beginInit()
+void AllThingsTalk_LTEM::setModemVIntPin(int8_t pin) {
+    saraR4xxOnOff.setVIntPin(pin);
+}
+
+void AllThingsTalk_LTEM::prepareInit() {
 	AllThingsTalk_LTEM::instance = this; // Important - Static pointer to our class
     mqtt.setServer(_credentials->getSpace(), 1883);
     mqtt.setAuth(_credentials->getDeviceToken(), "arbitrary");
     mqtt.setClientId(generateUniqueID().c_str());
     mqtt.setKeepAlive(300);
     if (callbackEnabled) { 
-        mqtt.setPublishHandler(this->mqttCallback);
+        mqtt.setPublishViewHandler(this->mqttCallback);
     }
     _modemSerial->begin(r4x.getDefaultBaudrate()); // The transport layer is a Sodaq_R4X
     r4x.init(&saraR4xxOnOff, *_modemSerial);
+    r4x.setBaudrateChangeHandler(modemBaudrateChanged);
+    if (modemBaudrate) {
+        r4x.setBaudrate(modemBaudrate); // applied once the modem is on
+    }
+    r4x.setSocketBinaryMode(true); // MQTT packets are sent as raw bytes instead of hex
     r4x_mqtt_APN = this->_APN;
     r4x_mqtt.setR4Xinstance(&r4x, r4x_mqttConnectNetwork);
+    offlineQueue.setR4Xinstance(&r4x, "att_queue_");
     mqtt.setTransport(&r4x_mqtt);
-    
-    return connect();
 }
 
 bool AllThingsTalk_LTEM::disconnect() {
@@ -119,11 +159,15 @@ bool AllThingsTalk_LTEM::disconnect() {
 }
 
 bool AllThingsTalk_LTEM::isConnected() {
+    if (poweringOn) {
+        return false;
+    }
     return r4x.isConnected();
 }
 
 bool AllThingsTalk_LTEM::connect() {
     intentionallyDisconnected = false;
+    poweringOn = false; // connecting waits for the modem itself
     if (connectNetwork() && connectMqtt()) {
         return true;
     } else {
@@ -137,9 +181,15 @@ bool AllThingsTalk_LTEM::connectNetwork() {
         debug("Already connected to Network!");
         return true;
     } else {
-        if (r4x.connect(_APN, URAT, MNOPROF, OPERATOR, M1_BAND_MASK, NB1_BAND_MASK)) {
+        // reconnect() takes the shortest way back after a link drop (including a full connect), the first time connect() is needed
+        bool connected = r4x.hasConnectParams() ? r4x.reconnect()
+                : r4x.connect(_APN, URAT, MNOPROF, OPERATOR, M1_BAND_MASK, NB1_BAND_MASK);
+        if (connected) {
             debug("Connected to Network!");
             showDiagnosticInfo(); // Shows FW, IMEI, ICCID, IMSI, etc
+            if (powerSavingEnabled) {
+                alignWithPowerSaving();
+            }
             return true;
         } else {
             debug("Failed to connect to network!");
@@ -151,10 +201,12 @@ bool AllThingsTalk_LTEM::connectNetwork() {
 bool AllThingsTalk_LTEM::connectMqtt() {
     debug("Connecting to MQTT...");
     int connectRetry = 0;
+    uint32_t connectStart = millis();
     // Use mqtt.ping to check if there's a real connection towards broker. Try 10 times before giving up.
     while (!mqtt.ping() && connectRetry < 10) {
         connectRetry++;
     }
+    r4x.recordTelemetry(TelemetryMqttConnect, connectStart, connectRetry != 10);
     if (connectRetry != 10) {
         debug("Successfully connected to MQTT!");
         if (callbackEnabled) {
@@ -187,39 +239,132 @@ void AllThingsTalk_LTEM::maintainMqtt() {
     }
 }
 
+// Summarize the connection telemetry: average duration and failures per operation, plus the current signal and cell
+bool AllThingsTalk_LTEM::getTelemetry(CborPayload &payload) {
+    // Short keys, the whole summary has to fit in a CborPayload. Only the operations that happened are added:
+    // "xx-ms" with its value (1 + key + 5 bytes), "xx-f" only if there were failures, then "rssi" (7) and "cell" (10)
+    static const char* const operationNames[TelemetryOperationsMAX] = { "att", "sc", "mc", "mp" };
+    uint8_t records = r4x.getTelemetryCount();
+    if (records == 0) {
+        return false;
+    }
+    unsigned int size = 7 + 10;
+    for (int op = 0; op < TelemetryOperationsMAX; op++) {
+        const TelemetrySummary *summary = r4x.getTelemetrySummary(op);
+        if (summary->count > 0) {
+            size += 1 + strlen(operationNames[op]) + 3 + 5;
+            if (summary->failures > 0) {
+                size += 1 + strlen(operationNames[op]) + 2 + 5;
+            }
+        }
+    }
+    if (payload.getFreeSpace() < size) {
+        debug("Telemetry does not fit in the payload");
+        return false;
+    }
+    char name[8];
+    for (int op = 0; op < TelemetryOperationsMAX; op++) {
+        const TelemetrySummary *summary = r4x.getTelemetrySummary(op);
+        if (summary->count > 0) {
+            snprintf(name, sizeof name, "%s-ms", operationNames[op]);
+            payload.set(name, (int)(summary->totalDuration / summary->count));
+            if (summary->failures > 0) {
+                snprintf(name, sizeof name, "%s-f", operationNames[op]);
+                payload.set(name, (int)summary->failures);
+            }
+        }
+    }
+    const TelemetryRecord *last = r4x.getTelemetryRecord(records - 1);
+    snprintf(name, sizeof name, "rssi");
+    payload.set(name, (int)last->rssi);
+    snprintf(name, sizeof name, "cell");
+    payload.set(name, (int)last->cellId);
+    return true;
+}
+
+bool AllThingsTalk_LTEM::setPowerSaving(uint32_t tau, uint32_t activeTime) {
+    powerSavingEnabled = (tau > 0);
+    if (!powerSavingEnabled) {
+        restorePingInterval();
+    }
+    return r4x.setPowerSavingMode(tau, activeTime);
+}
+
+bool AllThingsTalk_LTEM::setEdrx(uint8_t cycle, uint8_t pagingWindow) {
+    return r4x.setEdrx(cycle, pagingWindow, URAT[0] == SODAQ_R4X_NBIOT_URAT[0] ? EDRX_ACT_NBIOT : EDRX_ACT_LTEM);
+}
+
+bool AllThingsTalk_LTEM::setBaudrate(uint32_t baudrate) {
+    modemBaudrate = baudrate;
+    if (instance != this) {
+        return true; // init() applies it
+    }
+    return r4x.setBaudrate(baudrate);
+}
+
+void AllThingsTalk_LTEM::modemBaudrateChanged(uint32_t baudrate) {
+    instance->_modemSerial->begin(baudrate);
+}
+
+// Stretch the MQTT ping interval to the periodic TAU granted by the network, so the pings don't keep the radio awake
+void AllThingsTalk_LTEM::alignWithPowerSaving() {
+    uint32_t tau, activeTime;
+    if (!r4x.getPowerSavingTimers(&tau, &activeTime) || tau == 0) {
+        debugVerbose("Network did not grant Power Saving Mode, keeping the default ping interval");
+        restorePingInterval();
+        return;
+    }
+    debugVerbose("Network granted Power Saving Mode. Periodic TAU (s):", ' ');
+    debugVerbose(tau, ' ');
+    debugVerbose("Active Time (s):", ' ');
+    debugVerbose(activeTime);
+    if (!pingIntervalAligned) {
+        savedPingInterval = pingInterval;
+        savedKeepAlive = mqtt.getKeepAlive();
+        pingIntervalAligned = true;
+    }
+    pingInterval = min(tau, (uint32_t)43690); // Keep-alive is 1.5x the ping interval and can't exceed 65535
+    mqtt.setKeepAlive(pingInterval * 3 / 2);
+}
+
+// Undo alignWithPowerSaving(), the keep-alive is used from the next MQTT connect on
+void AllThingsTalk_LTEM::restorePingInterval() {
+    if (!pingIntervalAligned) {
+        return;
+    }
+    pingInterval = savedPingInterval;
+    mqtt.setKeepAlive(savedKeepAlive);
+    pingIntervalAligned = false;
+}
+
 bool AllThingsTalk_LTEM::send(CborPayload &payload) {
+    char topic[128];
+    snprintf(topic, sizeof topic, "device/%s/state", _credentials->getDeviceId());
     if (!intentionallyDisconnected) {
         if (isConnected()) {
-            char* topic;
-            int length = strlen(_credentials->getDeviceId()) + 14;  // 14 fixed chars + deviceId
-            topic = new char[length];
-            sprintf(topic, "device/%s/state", _credentials->getDeviceId());
-            topic[length-1] = 0;
-            if (mqtt.publish(topic, payload.getBytes(), payload.getSize(), 0, 0)) {
+            if (publish(topic, payload.getBytes(), payload.getSize(), 0)) {
                 debug("> Message Published to AllThingsTalk (CBOR)");
-                delete topic;
                 return true;
             } else {
                 debug("> Failed to Publish Message to AllThingsTalk (CBOR)");
-                delete topic;
-                return false;
             }
         }
     } else {
         debug("You're trying to send a message but you've disconnected from the network. Execute connect() to re-connect.");
     }
+    return storeMessage(topic, payload.getBytes(), payload.getSize());
 }
 
 template<typename T> bool AllThingsTalk_LTEM::send(char *asset, T value) {
+    char topic[128];
+    snprintf(topic, sizeof topic, "%s%s%s%s%s", "device/", _credentials->getDeviceId(), "/asset/", asset, "/state");
+    DynamicJsonDocument doc(256);
+    char JSONmessageBuffer[256];
+    doc["value"] = value;
+    serializeJson(doc, JSONmessageBuffer);
     if (!intentionallyDisconnected) {
         if (isConnected()) {
-            char topic[128];
-            snprintf(topic, sizeof topic, "%s%s%s%s%s", "device/", _credentials->getDeviceId(), "/asset/", asset, "/state");
-            DynamicJsonDocument doc(256);
-            char JSONmessageBuffer[256];
-            doc["value"] = value;
-            serializeJson(doc, JSONmessageBuffer);
-            if (mqtt.publish(topic, (unsigned char*)JSONmessageBuffer, strlen(JSONmessageBuffer), 0, 0)) {
+            if (publish(topic, (const uint8_t*)JSONmessageBuffer, strlen(JSONmessageBuffer), 0)) {
                 debug("> Message Published to AllThingsTalk (JSON)");
                 debugVerbose("Asset:", ' ');
                 debugVerbose(asset, ',');
@@ -228,12 +373,72 @@ template<typename T> bool AllThingsTalk_LTEM::send(char *asset, T value) {
                 return true;
             } else {
                 debug("> Failed to Publish Message to AllThingsTalk (JSON)");
-                return false;
             }
         }
     } else {
         debug("You're trying to send a message but you've disconnected from the network. Execute connect() to re-connect.");
     }
+    return storeMessage(topic, (const uint8_t*)JSONmessageBuffer, strlen(JSONmessageBuffer));
+}
+
+// Publish without retain and record it in the telemetry
+bool AllThingsTalk_LTEM::publish(const char* topic, const uint8_t* data, size_t size, uint8_t qos) {
+    uint32_t start = millis();
+    bool published = mqtt.publish(topic, data, size, qos, 0);
+    r4x.recordTelemetry(TelemetryMqttPublish, start, published);
+    return published;
+}
+
+// Keep a message that could not be published in the modem file system, returns false as it was not sent
+bool AllThingsTalk_LTEM::storeMessage(const char* topic, const uint8_t* data, size_t size) {
+    // The queue is kept in the modem, it can't be written while the modem boots
+    if (offlineQueueEnabled && !poweringOn && offlineQueue.push(topic, data, size)) {
+        debug("> Message stored, it will be published once connected again");
+    }
+    return false;
+}
+
+// Publish the stored messages oldest first, with QoS 1. The batch is sent without waiting for each PUBACK,
+// and only removed from the queue once the broker acknowledged all of it. Until then the MQTT layer
+// retransmits what is not acknowledged, and no new batch is replayed (that would publish it twice).
+void AllThingsTalk_LTEM::replayOfflineQueue() {
+    if (!offlineQueueEnabled || intentionallyDisconnected || !mqtt.isConnected()) {
+        return;
+    }
+    if (mqtt.getInflightCount() > 0) {
+        return;
+    }
+    acknowledgeOfflineBatch();
+    if (offlineQueue.isEmpty()) {
+        return;
+    }
+    offlineBatchSize = offlineQueue.replay(replayMessage, this, offlineReplayBatch);
+    if (offlineBatchSize > 0 && !mqtt.waitForAcks()) {
+        debugVerbose("> Stored messages not acknowledged yet, waiting for the broker");
+        return;
+    }
+    acknowledgeOfflineBatch();
+}
+
+void AllThingsTalk_LTEM::acknowledgeOfflineBatch() {
+    offlineQueue.acknowledge();
+    if (offlineBatchSize > 0) {
+        debugVerbose("> Stored messages published:", ' ');
+        debugVerbose(offlineBatchSize);
+        offlineBatchSize = 0;
+    }
+}
+
+bool AllThingsTalk_LTEM::replayMessage(const char* topic, const uint8_t* data, size_t size, void* context) {
+    return static_cast<AllThingsTalk_LTEM*>(context)->publish(topic, data, size, 1);
+}
+
+void AllThingsTalk_LTEM::setOfflineQueue(bool enabled) {
+    offlineQueueEnabled = enabled;
+}
+
+void AllThingsTalk_LTEM::clearOfflineQueue() {
+    offlineQueue.clear();
 }
 
 
@@ -248,6 +453,7 @@ bool AllThingsTalk_LTEM::sendSMS(char* number, char* message) {
 
 void AllThingsTalk_LTEM::showDiagnosticInfo() {
     if (justBooted) {
+        r4x.getModemIdentity(true); // One round trip, the getters below read from it
         getOperator();
         getICCID();
         getIMSI();
@@ -258,76 +464,50 @@ void AllThingsTalk_LTEM::showDiagnosticInfo() {
     }
 }
 
-char* AllThingsTalk_LTEM::getFirmwareVersion() {
-    char buffer[128];
-    if (r4x.getFirmwareVersion(buffer, sizeof(buffer))) {
-        debug("LTE-M Modem Firmware Version: ", ' ');
-        debug(buffer);
-        return buffer;
+// Prints an identity field of the modem, if there is one
+const char* AllThingsTalk_LTEM::showIdentityField(const char* title, const char* field, const char* error) {
+    if (field && field[0]) {
+        debug(title, ' ');
+        debug(field);
+        return field;
     } else {
-        debug("Couldn't get the firmware version.");
+        debug(error);
         return "ERROR";
     }
 }
 
-char* AllThingsTalk_LTEM::getFirmwareRevision() {
-    char buffer[128];
-    if (r4x.getFirmwareRevision(buffer, sizeof(buffer))) {
-        debug("LTE-M Modem Firmware Revision: ", ' ');
-        debug(buffer);
-        return buffer;
-    } else {
-        debug("Couldn't get the firmware revision.");
-        return "ERROR";
-    }
+const char* AllThingsTalk_LTEM::getFirmwareVersion() {
+    const ModemIdentity *identity = r4x.getModemIdentity();
+    return showIdentityField("LTE-M Modem Firmware Version:", identity ? identity->firmwareVersion : NULL, "Couldn't get the firmware version.");
 }
 
-char* AllThingsTalk_LTEM::getIMEI() {
-    char buffer[128];
-    if (r4x.getIMEI(buffer, sizeof(buffer))) {
-        debug("IMEI:", ' ');
-        debug(buffer);
-        return buffer;
-    } else {
-        debug("Couldn't get IMEI.");
-        return "ERROR";
-    }
+const char* AllThingsTalk_LTEM::getFirmwareRevision() {
+    const ModemIdentity *identity = r4x.getModemIdentity();
+    return showIdentityField("LTE-M Modem Firmware Revision:", identity ? identity->firmwareRevision : NULL, "Couldn't get the firmware revision.");
 }
 
-char* AllThingsTalk_LTEM::getICCID() {
-    char buffer[128];
-    if (r4x.getCCID(buffer, sizeof(buffer))) {
-        debug("ICCID:", ' ');
-        debug(buffer);
-        return buffer;
-    } else {
-        debug("Couldn't get ICCID.");
-        return "ERROR";
-    }
+const char* AllThingsTalk_LTEM::getIMEI() {
+    const ModemIdentity *identity = r4x.getModemIdentity();
+    return showIdentityField("IMEI:", identity ? identity->imei : NULL, "Couldn't get IMEI.");
 }
 
-char* AllThingsTalk_LTEM::getIMSI() {
-    char buffer[128];
-    if (r4x.getIMSI(buffer, sizeof(buffer))) {
-        debug("IMSI:", ' ');
-        debug(buffer);
-        return buffer;
-    } else {
-        debug("Couldn't get IMSI.");
-        return "ERROR";
-    }
+const char* AllThingsTalk_LTEM::getICCID() {
+    const ModemIdentity *identity = r4x.getModemIdentity();
+    return showIdentityField("ICCID:", identity ? identity->ccid : NULL, "Couldn't get ICCID.");
 }
 
-char* AllThingsTalk_LTEM::getOperator() {
-    char buffer[128];
-    if (r4x.getOperatorInfoString(buffer, sizeof(buffer))) {
-        debug("Operator Info:", ' ');
-        debug(buffer);
-        return buffer;
-    } else {
-        debug("Couldn't get Operator Info.");
-        return "ERROR";
+const char* AllThingsTalk_LTEM::getIMSI() {
+    const ModemIdentity *identity = r4x.getModemIdentity();
+    return showIdentityField("IMSI:", identity ? identity->imsi : NULL, "Couldn't get IMSI.");
+}
+
+// The operator can change, so it is queried again unless the identity was just read at boot
+const char* AllThingsTalk_LTEM::getOperator() {
+    if (!justBooted) {
+        r4x.refreshOperator();
     }
+    const ModemIdentity *identity = r4x.getModemIdentity();
+    return showIdentityField("Operator Info:", identity ? identity->operatorName : NULL, "Couldn't get Operator Info.");
 }
 
 bool AllThingsTalk_LTEM::setOperator(const char* apn) {
@@ -349,7 +529,24 @@ void AllThingsTalk_LTEM::reboot() {
 }
 
 void AllThingsTalk_LTEM::loop() {
+    if (poweringOn) {
+        // Started by beginInit(), connect once the modem answers
+        PowerOnStates state = r4x.pollPowerOn();
+        if (state != PowerOnReady && state != PowerOnFailed) {
+            return;
+        }
+        poweringOn = false;
+        if (state == PowerOnFailed) {
+            debug("Failed to power on the modem!");
+            return;
+        }
+        debug("Modem powered on");
+        connect();
+        return;
+    }
+    r4x.poll(); // handle URCs the modem sent since the last call, without blocking
     maintainMqtt();
+    replayOfflineQueue();
 }
 
 // Add boolean callback (0)
@@ -407,9 +604,9 @@ bool AllThingsTalk_LTEM::tryAddActuationCallback(String asset, void (*actuationC
 }
 
 // Retrieve a specific callback based on asset
-ActuationCallback *AllThingsTalk_LTEM::getActuationCallbackForAsset(String asset) {
+ActuationCallback *AllThingsTalk_LTEM::getActuationCallbackForAsset(const char* asset, size_t length) {
     for (int i = 0; i < actuationCallbackCount; i++) {
-        if (asset == actuationCallbacks[i].asset) {
+        if (actuationCallbacks[i].asset.length() == length && strncmp(actuationCallbacks[i].asset.c_str(), asset, length) == 0) {
             debugVerbose("Found Actuation Callback for Asset:", ' ');
             debugVerbose(actuationCallbacks[i].asset);
             return &actuationCallbacks[i];
@@ -418,38 +615,35 @@ ActuationCallback *AllThingsTalk_LTEM::getActuationCallbackForAsset(String asset
     return nullptr;
 }
 
-// Asset name extraction from MQTT topic
-String extractAssetNameFromTopic(String topic) {
-    // Topic is formed as: device/ID/asset/NAME/state
-    const int devicePrefixLength = 38;  // "device/ID/asset/"
-    const int stateSuffixLength = 8;  // "/state"
-    return topic.substring(devicePrefixLength, topic.length()-stateSuffixLength);
+// Asset name extraction from MQTT topic, without copying it
+static bool extractAssetNameFromTopic(const char* topic, const char*& name, size_t& length) {
+    // Topic is formed as: device/ID/asset/NAME/command
+    const char* assetPrefix = "/asset/";
+    const char* start = strstr(topic, assetPrefix);
+    if (!start) {
+        return false;
+    }
+    name = start + strlen(assetPrefix);
+    const char* end = strchr(name, '/');
+    length = end ? (size_t)(end - name) : strlen(name);
+    return true;
 }
 
 
-// MQTT Callback for receiving messages
-void AllThingsTalk_LTEM::mqttCallback(const char* p_topic, const uint8_t *p_payload, size_t p_length) {
-	instance->debugVerbose("--------------------------------------");
+// MQTT Callback for receiving messages, the topic and payload are only valid during the call
+void AllThingsTalk_LTEM::mqttCallback(const MQTTPublishView &message) {
+    instance->debugVerbose("--------------------------------------");
     instance->debug("< Message Received from AllThingsTalk");
 
-    String payload;
-    String topic(p_topic);
-    
     instance->debugVerbose("Raw Topic:", ' ');
-    instance->debugVerbose(p_topic);
+    instance->debugVerbose(message.topic);
 
     // Whole JSON Payload
-    for (uint8_t i = 0; i < p_length; i++) payload.concat((char)p_payload[i]);
-    instance->debugVerbose("Raw JSON Payload:", ' ');
-    instance->debugVerbose(payload);
-    
-    // Deserialize JSON
-    DynamicJsonDocument doc(256);
-    char json[256];
-    for (int i = 0; i < p_length; i++) {
-        json[i] = (char)p_payload[i];
-    }
-    auto error = deserializeJson(doc, json);
+    instance->debugVerbose("Raw JSON Payload:", (const char*)message.msg, message.msg_length);
+
+    // Deserialize JSON, straight from the payload (which is not NUL terminated)
+    DynamicJsonDocument doc(256 + message.msg_length);
+    auto error = deserializeJson(doc, (const char*)message.msg, message.msg_length);
     if (error) {
         instance->debug("Parsing JSON failed. Code:", ' ');
         instance->debug(error.c_str());
@@ -461,12 +655,16 @@ void AllThingsTalk_LTEM::mqttCallback(const char* p_topic, const uint8_t *p_payl
     const char* time = doc["at"];
     instance->debugVerbose(time);
 
-    String asset = extractAssetNameFromTopic(topic);
-    instance->debugVerbose("Asset Name:", ' ');
-    instance->debugVerbose(asset);
+    const char* asset;
+    size_t assetLength;
+    if (!extractAssetNameFromTopic(message.topic, asset, assetLength)) {
+        instance->debug("Error: There's no asset in the topic.");
+        return;
+    }
+    instance->debugVerbose("Asset Name:", asset, assetLength);
 
     // Call actuation callback for this specific asset
-    ActuationCallback *actuationCallback = instance->getActuationCallbackForAsset(asset);
+    ActuationCallback *actuationCallback = instance->getActuationCallbackForAsset(asset, assetLength);
     if (actuationCallback == nullptr) {
         instance->debug("Error: There's no actuation callback for this asset.");
         return;
@@ -6,6 +6,7 @@
 #include "Sodaq_R4X.h"
 #include "Sodaq_MQTT.h"
 #include "Sodaq_R4X_MQTT.h"
+#include "Sodaq_R4X_FileQueue.h"
 #include "ArduinoJson.h"
 #include "CborPayload.h"
 #include "APICredentials.h"
@@ -31,6 +32,11 @@ public:
     AllThingsTalk_LTEM(HardwareSerial &modemSerial, APICredentials &credentials, char* APN);
     void debugPort(Stream &debugSerial, bool verbose = false, bool verboseAT = false);
     bool init();
+    // Non-blocking init(): powers on the modem and returns, loop() connects once the modem answers.
+    // isInitializing() tells until then, send() fails in the meantime.
+    void beginInit();
+    bool isInitializing();
+    void setModemVIntPin(int8_t pin); // Optional, see Sodaq_SARA_R4XX_OnOff::setVIntPin()
     bool connect();
     bool disconnect();
     bool isConnected();
@@ -39,15 +45,32 @@ public:
     bool registerDevice(const char* deviceSecret, const char* partnerId);
     bool sendSMS(char* number, char* message);
     bool setOperator(const char* apn);
-    char* getFirmwareVersion();
-    char* getFirmwareRevision();
-    char* getIMEI();
-    char* getICCID();
-    char* getIMSI();
-    char* getOperator();
+    const char* getFirmwareVersion();
+    const char* getFirmwareRevision();
+    const char* getIMEI();
+    const char* getICCID();
+    const char* getIMSI();
+    const char* getOperator();
     void reboot();
     void loop();
 
+    // Connection telemetry (see Sodaq_R4X::recordTelemetry()), summarized for send(payload).
+    // Needs up to 62 bytes of the payload, up to 103 if every operation had failures. Returns false without
+    // adding anything if they are not free (a default CborPayload has 96).
+    bool getTelemetry(CborPayload &payload);
+
+    // Power saving (see Sodaq_R4X::setPowerSavingMode() and Sodaq_R4X::setEdrx())
+    bool setPowerSaving(uint32_t tau, uint32_t activeTime);
+    bool setEdrx(uint8_t cycle, uint8_t pagingWindow);
+
+    // Messages that can't be published are stored in the modem and published once connected again.
+    // Off by default, as it writes every failed message to the flash of the modem.
+    void setOfflineQueue(bool enabled);
+    void clearOfflineQueue();
+
+    // Modem UART speed (see Sodaq_R4X::setBaudrate()), can be called before init()
+    bool setBaudrate(uint32_t baudrate);
+
     // Callbacks (Receiving Data)
     bool setActuationCallback(String asset, void (*actuationCallback)(bool payload));
     bool setActuationCallback(String asset, void (*actuationCallback)(int payload));
@@ -60,13 +83,25 @@ private:
     static AllThingsTalk_LTEM* instance;
     template<typename T> void debug(T message, char separator = '\n');
     template<typename T> void debugVerbose(T message, char separator = '\n');
+    void debugVerbose(const char* title, const char* data, size_t length);
 
     String generateUniqueID();
+    void prepareInit();
     bool connectNetwork();
     bool connectMqtt();
     void maintainMqtt();
+    void alignWithPowerSaving();
+    void restorePingInterval();
+    static void modemBaudrateChanged(uint32_t baudrate);
+    bool publish(const char* topic, const uint8_t* data, size_t size, uint8_t qos);
+    bool storeMessage(const char* topic, const uint8_t* data, size_t size);
+    void replayOfflineQueue();
+    void acknowledgeOfflineBatch();
+    static bool replayMessage(const char* topic, const uint8_t* data, size_t size, void* context);
     bool justBooted = true;
+    bool poweringOn = false; // beginInit() is waiting for the modem
     void showDiagnosticInfo();
+    const char* showIdentityField(const char* title, const char* field, const char* error);
     HardwareSerial *_modemSerial;
     Stream *debugSerial;
     APICredentials *_credentials;
@@ -75,17 +110,26 @@ private:
     bool isSubscribed;
     char* _APN;
     int pingInterval = 25; // Seconds
+    bool powerSavingEnabled = false;
+    bool pingIntervalAligned = false; // The values below hold the ones from before alignWithPowerSaving()
+    int savedPingInterval;
+    uint16_t savedKeepAlive;
+    uint32_t modemBaudrate = 0; // 0 keeps the default
+    Sodaq_R4X_FileQueue offlineQueue;
+    bool offlineQueueEnabled = false;
+    static const int offlineReplayBatch = 8; // Messages published per loop()
+    size_t offlineBatchSize = 0; // Messages of the last batch not acknowledged yet
     unsigned long previousPing;
     bool intentionallyDisconnected;
 
     // Actuations / Callbacks
     static const int maximumActuations = 32;
     bool callbackEnabled = true;         // Variable for checking if callback is enabled
-	static void mqttCallback(const char* p_topic, const uint8_t *p_payload, size_t p_length);
+    static void mqttCallback(const MQTTPublishView &message);
     ActuationCallback actuationCallbacks[maximumActuations];
     int actuationCallbackCount = 0;
     bool tryAddActuationCallback(String asset, void *actuationCallback, int actuationCallbackArgumentType);
-    ActuationCallback *getActuationCallbackForAsset(String asset);
+    ActuationCallback *getActuationCallbackForAsset(const char* asset, size_t length);
 };
 
 #endif
\ No newline at end of file
@@ -144,6 +144,10 @@ unsigned int CborPayload::getSize() {
     return size;
 }
 
+unsigned int CborPayload::getFreeSpace() {
+    return capacity - output->getSize();
+}
+
 template<typename T> bool CborPayload::set(char *assetName, T value) {
     writer->writeString(assetName);
     write(value);
@@ -21,6 +21,7 @@ public:
 	virtual char* getString();
     virtual unsigned char* getBytes();
     virtual unsigned int getSize();
+    unsigned int getFreeSpace(); // Bytes left for set(), anything beyond is dropped
     virtual void reset();
 
 private:
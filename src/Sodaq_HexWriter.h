@@ -0,0 +1,51 @@
+#ifndef SODAQ_HEXWRITER_H_
+#define SODAQ_HEXWRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Characters the hex writer collects before writing them to the stream (on the stack).
+#ifndef HEX_WRITE_CHUNK_SIZE
+#define HEX_WRITE_CHUNK_SIZE 64
+#endif
+
+/*!
+ * \brief Writes "buffer" to "stream" as upper case hex, two characters per byte
+ *
+ * The characters are encoded with a table into a chunk of HEX_WRITE_CHUNK_SIZE
+ * and written with one write() per chunk, to "mirror" as well if it is not NULL.
+ * Used by Sodaq_R4X::writeHex() and by extras/benchmark, so any Stream-like class
+ * with write(const uint8_t*, size_t) will do.
+ *
+ * \returns The number of characters "stream" accepted
+ */
+template<typename S>
+size_t writeHexChunked(S* stream, S* mirror, const uint8_t* buffer, size_t size)
+{
+    static const char hexChars[] = "0123456789ABCDEF";
+
+    uint8_t chunk[HEX_WRITE_CHUNK_SIZE];
+    size_t  written = 0;
+
+    while (size > 0) {
+        size_t count = (size < sizeof(chunk) / 2) ? size : sizeof(chunk) / 2;
+
+        for (size_t i = 0; i < count; i++) {
+            chunk[2 * i]     = hexChars[(buffer[i] >> 4) & 0x0F];
+            chunk[2 * i + 1] = hexChars[buffer[i] & 0x0F];
+        }
+
+        if (mirror) {
+            mirror->write(chunk, 2 * count);
+        }
+
+        written += stream->write(chunk, 2 * count);
+
+        buffer += count;
+        size   -= count;
+    }
+
+    return written;
+}
+
+#endif /* SODAQ_HEXWRITER_H_ */
@@ -0,0 +1,21 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "Sodaq_Log.h"
+
+void sodaq_log_printf(Stream* stream, const char* format, ...)
+{
+    if (stream == NULL) {
+        return;
+    }
+
+    // shared by all the callers, the drivers only log from the main loop
+    static char buffer[SODAQ_LOG_BUFFER_SIZE];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    stream->println(buffer);
+}
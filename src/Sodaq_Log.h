@@ -0,0 +1,49 @@
+#ifndef SODAQ_LOG_H_
+#define SODAQ_LOG_H_
+
+/*
+ * Log levels of the modem and MQTT drivers.
+ *
+ * Define SODAQ_LOG_LEVEL (e.g. in the build flags) to one of the levels below.
+ * The messages of the levels above it are not compiled in at all; the others are
+ * formatted printf-style into a small static buffer, and only if a diag stream is set.
+ */
+
+#include "Arduino.h"
+
+#define SODAQ_LOG_LEVEL_NONE    0
+#define SODAQ_LOG_LEVEL_ERROR   1
+#define SODAQ_LOG_LEVEL_INFO    2
+#define SODAQ_LOG_LEVEL_DEBUG   3   // Also traces the AT commands and responses
+
+#ifndef SODAQ_LOG_LEVEL
+#define SODAQ_LOG_LEVEL SODAQ_LOG_LEVEL_DEBUG
+#endif
+
+// Size of the buffer the messages are formatted into; longer messages are truncated.
+#ifndef SODAQ_LOG_BUFFER_SIZE
+#define SODAQ_LOG_BUFFER_SIZE 128
+#endif
+
+// Formats the message and prints it as a line on "stream". Does nothing if "stream" is NULL.
+void sodaq_log_printf(Stream* stream, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#if SODAQ_LOG_LEVEL >= SODAQ_LOG_LEVEL_ERROR
+#define SODAQ_LOG_ERROR(stream, ...) sodaq_log_printf(stream, __VA_ARGS__)
+#else
+#define SODAQ_LOG_ERROR(stream, ...) do {} while (0)
+#endif
+
+#if SODAQ_LOG_LEVEL >= SODAQ_LOG_LEVEL_INFO
+#define SODAQ_LOG_INFO(stream, ...) sodaq_log_printf(stream, __VA_ARGS__)
+#else
+#define SODAQ_LOG_INFO(stream, ...) do {} while (0)
+#endif
+
+#if SODAQ_LOG_LEVEL >= SODAQ_LOG_LEVEL_DEBUG
+#define SODAQ_LOG_DEBUG(stream, ...) sodaq_log_printf(stream, __VA_ARGS__)
+#else
+#define SODAQ_LOG_DEBUG(stream, ...) do {} while (0)
+#endif
+
+#endif /* SODAQ_LOG_H_ */
@@ -33,40 +33,18 @@
 
 #include "Sodaq_MQTT.h"
 
-#define DEBUG
-#define DEBUG_PREFIX String("[MQTT]")
+#include "Sodaq_Log.h"
 
-#ifdef DEBUG
-#define debugPrintLn(...)   do { if (this->_diagStream) this->_diagStream->println(__VA_ARGS__); } while(0)
-#define debugPrint(...)     do { if (this->_diagStream) this->_diagStream->print(__VA_ARGS__); } while (0)
+#define errorPrintf(...)    SODAQ_LOG_ERROR(this->_diagStream, "[MQTT]" __VA_ARGS__)
+#define infoPrintf(...)     SODAQ_LOG_INFO(this->_diagStream, "[MQTT]" __VA_ARGS__)
+#define debugPrintf(...)    SODAQ_LOG_DEBUG(this->_diagStream, "[MQTT]" __VA_ARGS__)
+
+#if SODAQ_LOG_LEVEL >= SODAQ_LOG_LEVEL_DEBUG
 #define debugDump(buf, len) do { this->diagDumpBuffer(buf, len); } while (0)
 #else
-#define debugPrintLn(...)
-#define debugPrint(...)
 #define debugDump(buf, len)
 #endif
 
-class MQTTPacketInfo
-{
-public:
-    size_t _pckt_length;
-
-    char *_topic;
-    size_t _topic_size;
-    size_t _topic_length;
-
-    uint8_t *_msg;
-    size_t _msg_size;
-    size_t _msg_length;
-    size_t _msg_truncated_length;
-
-    bool _dup;
-    uint8_t _qos;
-    bool _retain;
-
-    uint16_t _msg_id;
-};
-
 MQTT::MQTT()
 {
     _state = ST_UNKNOWN;
@@ -78,9 +56,19 @@ MQTT::MQTT()
     _clientId = 0;
     _packetIdentifier = 0;
     _publishHandler = 0;
+    _publishViewHandler = 0;
     _packetHandler = 0;
     _keepAlive = MQTT_DEFAULT_KEEP_ALIVE;
     _diagStream = 0;
+    memset(_inflight, 0, sizeof(_inflight));
+    _inflightDataUsed = 0;
+    memset(_inboundQos2, 0, sizeof(_inboundQos2));
+    _inboundQos2Next = 0;
+    resetRxBuffer();
+    _waitType = 0;
+    _waitPacketId = 0;
+    _waitDone = false;
+    _waitReturnCode = 0;
 }
 
 /*!
@@ -167,16 +155,25 @@ void MQTT::setTransport(Sodaq_MQTT_Interface * transport)
  *
  * Create a PUBLISH packet and send it to the MQTT server
  *
- * \returns false if sending the message failed somehow
+ * With QoS 1 or 2 this does not wait for the acknowledgement. A copy of the
+ * message is kept (see MQTT_INFLIGHT_DATA_SIZE) until loop() receives the PUBACK,
+ * or PUBREC and PUBCOMP, and it is sent again (DUP) after MQTT_RETRY_INTERVAL
+ * and after a reconnect. See also waitForAcks().
+ *
+ * \returns false if sending the message failed somehow, or if there are
+ * already MQTT_MAX_INFLIGHT messages, or too much data, waiting for their
+ * acknowledgement
  */
 bool MQTT::publish(const char * topic, const uint8_t * msg, size_t msg_len, uint8_t qos, uint8_t retain)
 {
-    debugPrintLn(DEBUG_PREFIX + "PUBLISH topic: " + topic);
-    debugPrintLn(DEBUG_PREFIX + "PUBLISH msg: " + (const char *)msg);
+    debugPrintf("PUBLISH topic: %s", topic);
+    debugPrintf("PUBLISH msg: %.*s", (int)msg_len, (const char *)msg);
     debugDump(msg, msg_len);
     bool retval = false;
+    size_t topic_length = strlen(topic);
+    int8_t ix = -1;
 
-    if (_transport == 0) {
+    if (_transport == 0 || qos > 2) {
         goto ending;
     }
 
@@ -186,52 +183,50 @@ bool MQTT::publish(const char * topic, const uint8_t * msg, size_t msg_len, uint
         }
     }
 
-    newPacketIdentifier();
-
-    uint8_t pckt[MQTT_MAX_PACKET_LENGTH];
-    size_t pckt_len;
-    // Assemble the PUBLISH packet
-    pckt_len = assemblePublishPacket(pckt, sizeof(pckt), topic, msg, msg_len, qos, retain);
-    if (pckt_len == 0 || !_transport->sendMQTTPacket(pckt, pckt_len)) {
-        goto ending;
-    }
-
-    if (qos == 0) {
-        // Nothing to be received
-    } else if (qos == 1) {
-        // Handle incoming PUBACK
-        // Expecting PUBACK 4? 02 ?? ??
-        size_t pckt_size;
-        uint8_t mqtt_puback[4];
-        uint16_t pckt_id;
-        pckt_size = _transport->receiveMQTTPacket(mqtt_puback, sizeof(mqtt_puback));
-        if (pckt_size == 0) {
-            debugPrintLn(DEBUG_PREFIX + " timed out");
-            goto ending;
-        }
-        if (pckt_size != sizeof(mqtt_puback)) {
-            debugPrintLn(DEBUG_PREFIX + " wrong pckt_size " + pckt_size);
-            goto ending;
+    if (qos > 0) {
+        size_t data_size = topic_length + 1 + msg_len;
+        ix = findInflight(0);
+        if (ix < 0 || _inflightDataUsed + data_size > sizeof(_inflightData)) {
+            // Maybe some acknowledgements came in already
+            loop();
+            ix = findInflight(0);
         }
-        if (mqtt_puback[0] != (CPT_PUBACK << 4)) {
-            debugPrintLn(DEBUG_PREFIX + " not PUBACK");
+        if (ix < 0) {
+            errorPrintf(" too many messages in flight");
             goto ending;
         }
-        if (mqtt_puback[1] != 2) {
-            debugPrintLn(DEBUG_PREFIX + " not correct length");
+        if (_inflightDataUsed + data_size > sizeof(_inflightData)) {
+            errorPrintf(" too much data in flight");
             goto ending;
         }
-        pckt_id = ((uint16_t)mqtt_puback[2] << 8) | mqtt_puback[3];
-        if (pckt_id != _packetIdentifier) {
-            debugPrintLn(DEBUG_PREFIX + " wrong packet identifier");
-            goto ending;
+
+        uint8_t * data = _inflightData + _inflightDataUsed;
+        memcpy(data, topic, topic_length + 1);
+        memcpy(data + topic_length + 1, msg, msg_len);
+
+        newPacketIdentifier();
+
+        struct Inflight_s & inflight = _inflight[ix];
+        inflight.data_offset = _inflightDataUsed;
+        inflight.data_size = data_size;
+        _inflightDataUsed += data_size;
+        inflight.topic_length = topic_length;
+        inflight.msg_len = msg_len;
+        inflight.sent_time = millis();
+        inflight.packet_id = _packetIdentifier;
+        inflight.state = (qos == 1) ? INFLIGHT_WAIT_PUBACK : INFLIGHT_WAIT_PUBREC;
+        inflight.qos = qos;
+        inflight.retain = retain;
+        inflight.retries = 0;
+    }
+
+    if (!sendPublishPacket(topic, topic_length, msg, msg_len, qos, retain, false, _packetIdentifier)) {
+        if (ix >= 0) {
+            releaseInflight(ix);
         }
-    } else if (qos == 2) {
-        // Handle incoming PUBREC
-        // TODO
-    } else {
-        // Shouldn't happen
+        goto ending;
     }
+
     retval = true;
 
 ending:
@@ -252,6 +247,74 @@ bool MQTT::publish(const char * topic, const char * msg, uint8_t qos, uint8_t re
     return publish(topic, (const uint8_t *)msg, strlen(msg), qos, retain);
 }
 
+/*
+ * Send a PUBLISH packet, the Packet Identifier is only used if QoS is 1 or 2
+ *
+ * The fixed header, topic, packet identifier and message are sent as they are,
+ * only the headers are assembled.
+ */
+bool MQTT::sendPublishPacket(const char * topic, size_t topic_length, const uint8_t * msg, size_t msg_len,
+    uint8_t qos, uint8_t retain, bool dup, uint16_t packet_id)
+{
+    uint8_t header[1 + 4 + 2];
+    uint8_t pckt_id[2] = { highByte(packet_id), lowByte(packet_id) };
+    size_t header_len = assemblePublishHeader(header, sizeof(header), topic_length, msg_len, qos, retain, dup);
+    if (header_len == 0) {
+        errorPrintf(" PUBLISH too large");
+        return false;
+    }
+
+    MQTTIoVec iov[4];
+    size_t count = 0;
+    iov[count].data = header;
+    iov[count++].len = header_len;
+    iov[count].data = (const uint8_t *)topic;
+    iov[count++].len = topic_length;
+    if (qos == 1 || qos == 2) {
+        // Packet Identifier only if QoS 1 or 2
+        iov[count].data = pckt_id;
+        iov[count++].len = sizeof(pckt_id);
+    }
+    iov[count].data = msg;
+    iov[count++].len = msg_len;
+
+    return _transport->sendMQTTPacketv(iov, count);
+}
+
+/*!
+ * \brief The number of QoS 1 and 2 publishes still waiting for their acknowledgement
+ */
+size_t MQTT::getInflightCount()
+{
+    size_t count = 0;
+    for (size_t ix = 0; ix < MQTT_MAX_INFLIGHT; ++ix) {
+        if (_inflight[ix].state != INFLIGHT_FREE) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/*!
+ * \brief Wait until all QoS 1 and 2 publishes are acknowledged
+ * \param timeout The maximum time to wait (ms)
+ *
+ * \returns false if some are still waiting for their acknowledgement
+ */
+bool MQTT::waitForAcks(uint32_t timeout)
+{
+    uint32_t start = millis();
+    while (getInflightCount() > 0) {
+        if ((millis() - start) >= timeout || _state != ST_MQTT_CONNECTED) {
+            return false;
+        }
+        if (!loop()) {
+            delay(10);
+        }
+    }
+    return true;
+}
+
 /*!
  * \brief Subscribe
  * \param topic The topic of the publish
@@ -266,7 +329,7 @@ bool MQTT::publish(const char * topic, const char * msg, uint8_t qos, uint8_t re
  */
 bool MQTT::subscribe(const char * topic, uint8_t qos)
 {
-    debugPrintLn(DEBUG_PREFIX + "SUBSCRIBE topic: " + topic);
+    debugPrintf("SUBSCRIBE topic: %s", topic);
     bool retval = false;
 
     if (_transport == 0) {
@@ -281,45 +344,34 @@ bool MQTT::subscribe(const char * topic, uint8_t qos)
 
     newPacketIdentifier();
 
-    uint8_t pckt[MQTT_MAX_PACKET_LENGTH];
-    size_t pckt_len;
-    // Assemble the SUBSCRIBE packet
-    pckt_len = assembleSubscribePacket(pckt, sizeof(pckt), topic, qos);
-    if (pckt_len == 0 || !_transport->sendMQTTPacket(pckt, pckt_len)) {
-        debugPrintLn(DEBUG_PREFIX + " failed to send SUBSCRIBE");
-        goto ending;
+    {
+        // Only the headers are assembled, the topic is sent as it is
+        uint8_t header[1 + 4 + 2 + 2];
+        uint8_t requested_qos = qos & 0x3;
+        size_t topic_length = strlen(topic);
+        size_t header_len = assembleSubscribeHeader(header, sizeof(header), topic_length);
+
+        MQTTIoVec iov[3] = {
+            { header, header_len },
+            { (const uint8_t *)topic, topic_length },
+            { &requested_qos, 1 }
+        };
+
+        if (header_len == 0 || !_transport->sendMQTTPacketv(iov, 3)) {
+            errorPrintf(" failed to send SUBSCRIBE");
+            goto ending;
+        }
     }
 
-    // Receive the SUBACK packet
-    // Expecting SUBACK 90 03 00 01 00
-    size_t pckt_size;
-    uint8_t mqtt_suback[5];
-    uint16_t pckt_id;
-    //uint8_t suback_return_code;
-    pckt_size = _transport->receiveMQTTPacket(mqtt_suback, sizeof(mqtt_suback));
-    if (pckt_size == 0) {
-        debugPrintLn(DEBUG_PREFIX + " timed out");
+    // Wait for the SUBACK packet
+    if (!waitForPacket(CPT_SUBACK, _packetIdentifier)) {
+        errorPrintf(" no SUBACK");
         goto ending;
     }
-    if (pckt_size != sizeof(mqtt_suback)) {
-        debugPrintLn(DEBUG_PREFIX + " wrong pckt_size " + pckt_size);
+    if (_waitReturnCode == 0x80) {
+        errorPrintf(" subscription refused");
         goto ending;
     }
-    if (mqtt_suback[0] != (CPT_SUBACK << 4)) {
-        debugPrintLn(DEBUG_PREFIX + " not SUBACK");
-        goto ending;
-    }
-    if (mqtt_suback[1] != 3) {
-        debugPrintLn(DEBUG_PREFIX + " not correct length");
-        goto ending;
-    }
-    pckt_id = ((uint16_t)mqtt_suback[2] << 8) | mqtt_suback[3];
-    if (pckt_id != _packetIdentifier) {
-        debugPrintLn(DEBUG_PREFIX + " wrong packet identifier");
-        goto ending;
-    }
-    //suback_return_code = mqtt_suback[4];
-    // TODO Decide what we want to do with this
 
     retval = true;
 
@@ -329,7 +381,7 @@ ending:
 
 bool MQTT::ping()
 {
-    debugPrintLn(DEBUG_PREFIX + "PINGREQ");
+    debugPrintf("PINGREQ");
     bool retval = false;
 
     if (_transport == 0) {
@@ -344,35 +396,18 @@ bool MQTT::ping()
 
     newPacketIdentifier();
 
-    uint8_t pckt[MQTT_MAX_PACKET_LENGTH];
+    uint8_t pckt[2];
     size_t pckt_len;
-    // Assemble the SUBSCRIBE packet
+    // Assemble the PINGREQ packet
     pckt_len = assemblePingreqPacket(pckt, sizeof(pckt));
     if (pckt_len == 0 || !_transport->sendMQTTPacket(pckt, pckt_len)) {
-        debugPrintLn(DEBUG_PREFIX + " failed to send PINGREQ");
+        errorPrintf(" failed to send PINGREQ");
         goto ending;
     }
 
-    // Receive the PINGRESP packet
-    // Expecting PINGRESP D0 00
-    size_t pckt_size;
-    uint8_t reply_pckt[2];
-    //uint8_t suback_return_code;
-    pckt_size = _transport->receiveMQTTPacket(reply_pckt, sizeof(reply_pckt));
-    if (pckt_size == 0) {
-        debugPrintLn(DEBUG_PREFIX + " timed out");
-        goto ending;
-    }
-    if (pckt_size != sizeof(reply_pckt)) {
-        debugPrintLn(DEBUG_PREFIX + " wrong pckt_size " + pckt_size);
-        goto ending;
-    }
-    if (reply_pckt[0] != (CPT_PINGRESP << 4)) {
-        debugPrintLn(DEBUG_PREFIX + " not PINGRESP");
-        goto ending;
-    }
-    if (reply_pckt[1] != 0) {
-        debugPrintLn(DEBUG_PREFIX + " not correct length");
+    // Wait for the PINGRESP packet
+    if (!waitForPacket(CPT_PINGRESP, 0)) {
+        errorPrintf(" no PINGRESP");
         goto ending;
     }
 
@@ -386,82 +421,29 @@ ending:
  * \brief do stuff
  *
  * This function is used to do the following:
+ *  - send again the PUBLISH and PUBREL packets that were not acknowledged in time
  *  - read incoming packets and call handlers (if there is one)
+ *  - acknowledge incoming QoS 1 and 2 publishes and handle the acknowledgements
+ *    of outgoing ones
+ *
+ * \returns true if a packet was received
  */
 bool MQTT::loop()
 {
+    if (_transport == 0) {
+        return false;
+    }
+
+    retransmitInflight(false);
+
     // Is there a packet?
-    bool status;
-    size_t pckt_size;
-    size_t pckt_ix;
-    pckt_size = _transport->availableMQTTPacket();
-    if (pckt_size > 0) {
-        uint8_t mqtt_packets[256];
-        char topic[128];
-        uint8_t msg[128];
-        MQTTPacketInfo pckt_info;
-
-        pckt_size = _transport->receiveMQTTPacket(mqtt_packets, sizeof(mqtt_packets));
-        if (pckt_size > 0) {
-            // TODO
-
-            debugPrintLn(DEBUG_PREFIX + " received packet:");
-            debugDump(mqtt_packets, pckt_size);
-
-            // Notice that there can be multiple MQTT packet
-            pckt_ix = 0;
-            while (pckt_ix < pckt_size) {
-                switch ((mqtt_packets[pckt_ix] >> 4) & 0xF) {
-                case CPT_PUBLISH:
-
-                    memset(&pckt_info, 0, sizeof(pckt_info));
-                    pckt_info._topic = topic;
-                    pckt_info._topic_size = sizeof(topic);
-                    pckt_info._msg = msg;
-                    pckt_info._msg_size = sizeof(msg);
-
-                    status = dissectPublishPacket(&mqtt_packets[pckt_ix], pckt_size - pckt_ix, pckt_info);
-                    if (status) {
-                        if (pckt_info._qos == 0) {
-                            // Nothing else to do
-                        } else if (pckt_info._qos == 1) {
-                            // TODO
-                            // Send PUBACK
-                        } else if (pckt_info._qos == 2) {
-                            // TODO
-                            // Send PUBREC
-                        } else {
-                            // Shouldn't happen
-                        }
-
-                        if (_publishHandler) {
-                            _publishHandler(topic, msg, pckt_info._msg_truncated_length);
-                        }
-                        pckt_ix += pckt_info._pckt_length;
-                    }
-                    else {
-                        // TODO
-                        // We don't know if we can trust the computed length
-                        // For now skip the rest
-                        pckt_ix = pckt_size;
-                    }
-                    break;
-                default:
-                    if (_packetHandler) {
-                        _packetHandler(&mqtt_packets[pckt_ix], pckt_size - pckt_ix);
-                    }
-                    // TODO
-                    // We don't know the packet size. There can be multiple
-                    // For now skip the rest
-                    pckt_ix = pckt_size;
-                    break;
-                }
-            }
-        }
-        return true;
+    size_t dispatched = dispatchRxBuffer();
+    if (_transport->availableMQTTPacket() > 0) {
+        readRxBuffer(0);
+        dispatched += dispatchRxBuffer();
     }
 
-    return false;
+    return dispatched > 0;
 }
 
 /*!
@@ -469,7 +451,7 @@ bool MQTT::loop()
  */
 bool MQTT::availablePacket()
 {
-    return _transport->availableMQTTPacket() > 0;
+    return _rxStart < _rxEnd || _transport->availableMQTTPacket() > 0;
 }
 
 /*!
@@ -503,11 +485,28 @@ void MQTT::setStateClosed()
     _state = ST_TCP_CLOSED;
 }
 
+/*!
+ * \brief Set the handler of incoming messages
+ *
+ * The message is NUL terminated (not counted in msg_length), it can be used as a
+ * C string if it has no NUL of its own. Both are only valid during the call.
+ */
 void MQTT::setPublishHandler(void (*handler)(const char *topic, const uint8_t *msg, size_t msg_length))
 {
     _publishHandler = handler;
 }
 
+/*!
+ * \brief Set the handler of incoming messages that gets them as a view into the receive buffer
+ *
+ * It is called instead of the publish handler. Neither copies nor truncates the
+ * message, both are limited by MQTT_RX_BUFFER_SIZE only.
+ */
+void MQTT::setPublishViewHandler(void (*handler)(const MQTTPublishView &view))
+{
+    _publishViewHandler = handler;
+}
+
 void MQTT::setPacketHandler(void (*handler)(uint8_t *pckt, size_t len))
 {
     _packetHandler = handler;
@@ -521,6 +520,8 @@ bool MQTT::open()
     if (_state != ST_TCP_OPEN) {
         if (_transport->openMQTT(_server, _port)) {
             _state = ST_TCP_OPEN;
+            // Nothing of a previous connection is of use
+            resetRxBuffer();
         }
     }
     return _state == ST_TCP_OPEN;
@@ -531,7 +532,7 @@ bool MQTT::open()
  */
 bool MQTT::connect()
 {
-    debugPrintLn(DEBUG_PREFIX + "CONNECT");
+    debugPrintf("CONNECT");
     bool retval = false;
 
     if (!open()) {
@@ -546,36 +547,25 @@ bool MQTT::connect()
         goto ending;
     }
 
-    // Receive the CONNACK packet
-    // Expecting CONNACK 20 02 00 00
-    size_t pckt_size;
-    uint8_t mqtt_connack[4];
-    pckt_size = _transport->receiveMQTTPacket(mqtt_connack, sizeof(mqtt_connack));
-    if (pckt_size == 0) {
-        debugPrintLn(DEBUG_PREFIX + " timed out");
-        goto ending;
-    }
-    if (pckt_size != sizeof(mqtt_connack)) {
-        debugPrintLn(DEBUG_PREFIX + " wrong pckt_size " + pckt_size);
-        goto ending;
-    }
-    if (pckt_size != sizeof(mqtt_connack)) {
-        goto ending;
-    }
-    if (mqtt_connack[0] != (CPT_CONNACK << 4)) {
-        debugPrintLn(DEBUG_PREFIX + " not CONNACK, but " + (mqtt_connack[0] >> 4));
+    // Wait for the CONNACK packet
+    if (!waitForPacket(CPT_CONNACK, 0)) {
+        errorPrintf(" no CONNACK");
         goto ending;
     }
     // Return code
-    if (mqtt_connack[3] != 0) {
-        debugPrintLn(DEBUG_PREFIX + " connection not accepted, return code " + mqtt_connack[3]);
+    if (_waitReturnCode != 0) {
+        errorPrintf(" connection not accepted, return code %d", _waitReturnCode);
         goto ending;
     }
 
     // All went well
+    infoPrintf(" connected to %s", _server);
     _state = ST_MQTT_CONNECTED;
     retval = true;
 
+    // Whatever was not acknowledged before is sent again
+    retransmitInflight(true);
+
 ending:
     return retval;
 }
@@ -587,7 +577,7 @@ ending:
  */
 bool MQTT::disconnect()
 {
-    debugPrintLn(DEBUG_PREFIX + "DISCONNECT");
+    debugPrintf("DISCONNECT");
     bool retval = false;
     uint8_t pckt[2];
     pckt[0] = (CPT_DISCONNECT << 4);
@@ -608,26 +598,34 @@ ending:
 size_t MQTT::assembleConnectPacket(uint8_t * pckt, size_t size, uint16_t keepAlive)
 {
     // Assume pckt is not NULL
-    // If name is not NULL then pw should be not NULL either.
     uint8_t * ptr = pckt;
 
     const char * protocol_name = "MQTT";
     const int protocol_level = 4;
 
+    // The name and password are only sent if both are given
+    bool auth = (_name != 0 && _password != 0);
+    const char * client_id = _clientId ? _clientId : "";
+
     size_t len;
-    size_t pckt_len = 2 + strlen(protocol_name)
+    size_t remaining = 2 + strlen(protocol_name)
               + 4
-              + 2 + strlen(_clientId)
-              + 2 + strlen(_name)
+              + 2 + strlen(client_id);
+    if (auth) {
+        remaining += 2 + strlen(_name)
               + 2 + strlen(_password);
-    if (size < (pckt_len + 2)) {
-        // Oops. It does not fit. Truncate and hope for the best.
-        pckt_len = size - 2;
+    }
+
+    uint8_t rl[4];
+    size_t nrBytesRL = putRemainingLength(rl, remaining);
+    if (nrBytesRL == 0 || (1 + nrBytesRL + remaining) > size) {
+        errorPrintf(" CONNECT does not fit in %u bytes", (unsigned)size);
+        return 0;
     }
 
     *ptr++ = (CPT_CONNECT << 4) | 0;
-    // Assume length smaller than 128, or else we need multi byte length
-    *ptr++ = pckt_len;
+    memcpy(ptr, rl, nrBytesRL);
+    ptr += nrBytesRL;
 
     // Variable header:
     //   Protocol Name,
@@ -641,7 +639,7 @@ size_t MQTT::assembleConnectPacket(uint8_t * pckt, size_t size, uint16_t keepAli
     *ptr++ = protocol_level;
     //   Connect Flags,
     uint8_t flags = 0;
-    if (_name != 0 && _password != 0) {
+    if (auth) {
         flags |= (1 << 7) | (1 << 6);
     }
     flags |= (1 << 1);            // clean session
@@ -650,84 +648,76 @@ size_t MQTT::assembleConnectPacket(uint8_t * pckt, size_t size, uint16_t keepAli
     *ptr++ = keepAlive >> 8;
     *ptr++ = keepAlive & 0xFF;
 
-    len = strlen(_clientId);
+    len = strlen(client_id);
     *ptr++ = highByte(len);
     *ptr++ = lowByte(len);
-    memcpy(ptr, _clientId, len);
+    memcpy(ptr, client_id, len);
     ptr += len;
 
-    len = strlen(_name);
-    *ptr++ = highByte(len);
-    *ptr++ = lowByte(len);
-    memcpy(ptr, _name, len);
-    ptr += len;
-
-    len = strlen(_password);
-    *ptr++ = highByte(len);
-    *ptr++ = lowByte(len);
-    memcpy(ptr, _password, len);
-    ptr += len;
+    if (auth) {
+        len = strlen(_name);
+        *ptr++ = highByte(len);
+        *ptr++ = lowByte(len);
+        memcpy(ptr, _name, len);
+        ptr += len;
+
+        len = strlen(_password);
+        *ptr++ = highByte(len);
+        *ptr++ = lowByte(len);
+        memcpy(ptr, _password, len);
+        ptr += len;
+    }
 
-    debugPrintLn(DEBUG_PREFIX + "CONNECT packet:");
-    debugDump(pckt, pckt_len + 2);
+    debugPrintf("CONNECT packet:");
+    debugDump(pckt, ptr - pckt);
 
-    return pckt_len + 2;
+    return ptr - pckt;
 }
 
 /*!
- * \brief Assemble a PUBLISH packet
+ * \brief Assemble the headers of a PUBLISH packet
+ * \param header The buffer to store the headers, at least 7 bytes
+ * \param topic_length The length of the topic, which follows the headers
+ * \param msg_len The length of the message, which follows the topic (and packet identifier)
  *
- * \returns The size of the assembled packet.
+ * The fixed header, the Remaining Length (1..4 bytes) and the length of the topic
+ * are assembled, the rest of the packet is sent as is (see publish()).
+ *
+ * \returns The size of the assembled headers, 0 if the packet is too large.
  */
-size_t MQTT::assemblePublishPacket(uint8_t * pckt, size_t size,
-    const char * topic, const uint8_t * msg, size_t msg_len, uint8_t qos, uint8_t retain)
+size_t MQTT::assemblePublishHeader(uint8_t * header, size_t size,
+    size_t topic_length, size_t msg_len, uint8_t qos, uint8_t retain, bool dup)
 {
-    // Assume pckt is not NULL
-    uint8_t * ptr = pckt;
+    // Assume header is not NULL
+    uint8_t * ptr = header;
+
+    if (topic_length > 0xFFFF || size < (1 + 4 + 2)) {
+        return 0;
+    }
 
     // First compute the "remaining length"
-    size_t topic_length = strlen(topic);
-    size_t remaining = 0;
+    uint32_t remaining = 0;
     remaining += 2 + topic_length;
     if (qos == 1 || qos == 2) {
         remaining += 2;
     }
-    remaining += msg_len;
-    if (remaining > 127) {
-        // TODO We only support max 127 bytes remaining length
-        return 0;
-    }
-    if ((remaining + 2) > size) {
-        // Oops. It does not fit.
+    if (msg_len > (MQTT_MAX_REMAINING_LENGTH - remaining)) {
         return 0;
     }
+    remaining += msg_len;
 
     // Header
-    const uint8_t dup = 0;
-    *ptr++ = (CPT_PUBLISH << 4) | ((dup & 0x01) << 3) | ((qos & 0x03) << 1) | ((retain & 0x01) << 0);
-    // Assume length smaller than 128, or else we need multi byte length
-    *ptr++ = remaining;
+    *ptr++ = (CPT_PUBLISH << 4) | ((dup ? 1 : 0) << 3) | ((qos & 0x03) << 1) | ((retain & 0x01) << 0);
+    ptr += putRemainingLength(ptr, remaining);
 
-    // Add Topic. 2 byte length of topic (MSB, LSB) followed by topic
+    // 2 byte length of topic (MSB, LSB), the topic itself follows
     *ptr++ = highByte(topic_length);
     *ptr++ = lowByte(topic_length);
-    memcpy(ptr, topic, topic_length);
-    ptr += topic_length;
 
-    // Add (optional) Packet Identifier
-    if (qos == 1 || qos == 2) {
-        // Packet Identifier only if QoS 1 or 2
-        *ptr++ = (_packetIdentifier >> 8) & 0xFF;
-        *ptr++ = _packetIdentifier & 0xFF;
-    }
-
-    // Add Payload = topic message
-    memcpy(ptr, msg, msg_len);
-
-    debugPrintLn(DEBUG_PREFIX + "PUBLISH packet:");
-    debugDump(pckt, remaining + 2);
+    debugPrintf("PUBLISH header:");
+    debugDump(header, ptr - header);
 
-    return remaining + 2;
+    return ptr - header;
 }
 
 /*!
@@ -746,75 +736,62 @@ size_t MQTT::assemblePingreqPacket(uint8_t * pckt, size_t size)
     *ptr++ = (CPT_PINGREQ << 4);
     *ptr++ = remaining;
 
-    debugPrintLn(DEBUG_PREFIX + "PINGREQ packet:");
+    debugPrintf("PINGREQ packet:");
     debugDump(pckt, remaining + 2);
 
     return remaining + 2;
 }
 
 /*!
- * \brief Assemble a SUBSCRIBE packet
- * \param pckt The buffer to store the assembled packet
- * \param topic The size of the pckt buffer
- * \param topic The topic filter of the subscribe
- * \param qos The QoS of the topic
+ * \brief Assemble the headers of a SUBSCRIBE packet
+ * \param header The buffer to store the headers, at least 9 bytes
+ * \param size The size of the header buffer
+ * \param topic_length The length of the topic filter, which follows the headers
  *
- * \returns The size of the assembled packet.
+ * \returns The size of the assembled headers, 0 if the topic is too long.
  *
  * The SUBSCRIBE packet:
- *   1 byte length
+ *   1..4 bytes Remaining Length
  *   2 bytes Packet Identifier
  *   One or more Topic Filers, each:
  *     2 bytes length
  *     N bytes topic
  *     1 byte QoS (only bits 0, 1)
- * In this function we only have one topic filter.
+ * In this function we only have one topic filter, the topic and QoS are sent
+ * after the headers (see subscribe()).
  */
-size_t MQTT::assembleSubscribePacket(uint8_t * pckt, size_t size,
-    const char * topic, uint8_t qos)
+size_t MQTT::assembleSubscribeHeader(uint8_t * header, size_t size, size_t topic_length)
 {
-    // Assume pckt is not NULL
-    uint8_t * ptr = pckt;
+    // Assume header is not NULL
+    uint8_t * ptr = header;
 
-    const int topic_extra = 3;          // 2 bytes length, 1 byte QoS
-    int max_topic_length = size - (2 + topic_extra);
-    int topic_length = strlen(topic);
-    if (topic_length > max_topic_length) {
-        // Oops. It does not fit. Truncate and hope for the best.
-        topic_length = max_topic_length;
+    if (topic_length > 0xFFFF || size < (1 + 4 + 2 + 2)) {
+        return 0;
     }
 
-    size_t pckt_len = 2 + topic_length + topic_extra;
+    const size_t topic_extra = 3;       // 2 bytes length, 1 byte QoS
+
     *ptr++ = (CPT_SUBSCRIBE << 4) | (2 << 0);         // reserved field must be 0010
-    // Assume length smaller than 128, or else we need multi byte length, see note about
-    // Remaining Length above
-    *ptr++ = pckt_len;
+    ptr += putRemainingLength(ptr, 2 + topic_length + topic_extra);
 
     *ptr++ = (_packetIdentifier >> 8) & 0xFF;
     *ptr++ = _packetIdentifier & 0xFF;
 
-    // 2 byte length of topic (MSB, LSB) followed by topic
+    // 2 byte length of topic (MSB, LSB), the topic itself follows
     *ptr++ = highByte(topic_length);
     *ptr++ = lowByte(topic_length);
-    memcpy(ptr, topic, topic_length);
-    ptr += topic_length;
-    *ptr++ = qos & 0x3;
 
-    debugPrintLn(DEBUG_PREFIX + "SUBSCRIBE packet:");
-    debugDump(pckt, pckt_len + 2);
+    debugPrintf("SUBSCRIBE header:");
+    debugDump(header, ptr - header);
 
-    return pckt_len + 2;
+    return ptr - header;
 }
 
 /*
  * \brief Dissect a PUBLISH packet
- * \param[in] pckt The buffer to store the assembled packet
- * \param[in] len The length of the pckt buffer
- * \param[out] topic The buffer to store the topic
- * \param[in] topic_size The size of buffer to store the topic
- * \param[out] msg The buffer to store the message
- * \param[in] msg_size The size of buffer to store the message
- * \param[out] msg_length The length of the message
+ * \param[in,out] pckt The complete packet, in the receive buffer
+ * \param[in] len The length of the packet
+ * \param[out] view The topic and message, pointing into pckt
  *
  * The PUBLISH packet contains the following:
  *   - fixed header containg:
@@ -825,25 +802,23 @@ size_t MQTT::assembleSubscribePacket(uint8_t * pckt, size_t size,
  *   -- message ID (only if QoS level 1 or 2)
  *   - payload (can be 0 bytes or more)
  *
- * The caller is responsible for the receiving message (payload). For this
- * function the payload is binary, not text. If the caller knows that the
- * message is text it should pass a size which is one smaller that the allocated
- * space, and that one byte extra must be set to zero before using the string.
+ * Nothing is copied. To NUL terminate the topic it is moved onto its own
+ * 2 byte length, the message stays where it is. That leaves at least one spare
+ * byte between the topic and the message.
  *
- * The \a msg_length is the truncated length of the message if the actual message
- * was more that what fits in \a msg.
+ * \returns false if the packet is malformed
  */
-bool MQTT::dissectPublishPacket(const uint8_t * pckt, size_t len, MQTTPacketInfo &pckt_info)
+bool MQTT::dissectPublishPacket(uint8_t * pckt, size_t len, MQTTPublishView &view)
 {
-    const uint8_t *ptr;
+    uint8_t *ptr;
 
-    debugPrintLn(DEBUG_PREFIX + "  dissectPublish");
+    debugPrintf("  dissectPublish");
     ptr = pckt;
 
     // uint8_t msg_type = (*ptr >> 4) & 0xF;
-    pckt_info._dup = ((*ptr >> 3) & 0x1) ? true : false;
-    pckt_info._qos = (*ptr >> 1) & 0x3;
-    pckt_info._retain = ((*ptr >> 0) & 0x1) ? true : false;
+    view.dup = ((*ptr >> 3) & 0x1) ? true : false;
+    view.qos = (*ptr >> 1) & 0x3;
+    view.retain = ((*ptr >> 0) & 0x1) ? true : false;
 
     ptr++;
 
@@ -851,55 +826,513 @@ bool MQTT::dissectPublishPacket(const uint8_t * pckt, size_t len, MQTTPacketInfo
     size_t nrBytesRL = 0;
     uint32_t remaining = getRemainingLength(ptr, nrBytesRL);
     ptr += nrBytesRL;
-    debugPrintLn(DEBUG_PREFIX + "    remaining=" + remaining);
-
-    pckt_info._pckt_length = 1 + nrBytesRL + remaining;
-    debugPrintLn(DEBUG_PREFIX + "    total size=" + pckt_info._pckt_length);
+    debugPrintf("    remaining=%u", (unsigned)remaining);
 
-    pckt_info._topic_length = get_uint16_be(ptr);
-    ptr += 2;
-    remaining -= pckt_info._topic_length + 2;
+    if ((1 + nrBytesRL + remaining) > len || remaining < 2 || view.qos == 3) {
+        return false;
+    }
 
-    memset(pckt_info._topic, 0, pckt_info._topic_size);
-    size_t my_topic_length = pckt_info._topic_length;
-    if (my_topic_length > (pckt_info._topic_size - 1)) {
-        // Maximize so that it fits in the given buffer, with NUL
-        my_topic_length = pckt_info._topic_size - 1;
+    view.topic_length = get_uint16_be(ptr);
+    size_t header_length = 2 + view.topic_length + ((view.qos == 1 || view.qos == 2) ? 2 : 0);
+    if (header_length > remaining) {
+        return false;
     }
-    memcpy(pckt_info._topic, ptr, my_topic_length);
-    ptr += pckt_info._topic_length;
-    debugPrintLn(DEBUG_PREFIX + "    topic length=" + pckt_info._topic_length);
-    debugPrintLn(DEBUG_PREFIX + "    topic=" + pckt_info._topic);
 
-    pckt_info._msg_id = 0;
-    if (pckt_info._qos == 1 || pckt_info._qos == 2) {
-        pckt_info._msg_id = get_uint16_be(ptr);
+    memmove(ptr, ptr + 2, view.topic_length);
+    ptr[view.topic_length] = '\0';
+    view.topic = (const char *)ptr;
+    ptr += 2 + view.topic_length;
+    debugPrintf("    topic length=%u", (unsigned)view.topic_length);
+    debugPrintf("    topic=%s", view.topic);
+
+    view.packet_id = 0;
+    if (view.qos == 1 || view.qos == 2) {
+        view.packet_id = get_uint16_be(ptr);
         ptr += 2;
-        debugPrintLn(DEBUG_PREFIX + "    msg ID=" + pckt_info._msg_id);
+        debugPrintf("    msg ID=%u", view.packet_id);
     }
 
-    pckt_info._msg_length = remaining;
-    memset(pckt_info._msg, 0, pckt_info._msg_size);
-    pckt_info._msg_truncated_length = pckt_info._msg_length;
-    if (pckt_info._msg_truncated_length > pckt_info._msg_size) {
-        pckt_info._msg_truncated_length = pckt_info._msg_size;
-    }
-    memcpy(pckt_info._msg, ptr, pckt_info._msg_truncated_length);
-    debugPrintLn(DEBUG_PREFIX + "    msg length=" + pckt_info._msg_length);
-    debugPrintLn(DEBUG_PREFIX + "    truncated msg length=" + pckt_info._msg_truncated_length);
+    view.msg = ptr;
+    view.msg_length = remaining - header_length;
+    debugPrintf("    msg length=%u", (unsigned)view.msg_length);
 
     return true;
 }
 
+/*
+ * Forget the received data, e.g. of a previous connection
+ */
+void MQTT::resetRxBuffer()
+{
+    _rxStart = 0;
+    _rxEnd = 0;
+    _rxDiscard = 0;
+    _rxDepth = 0;
+}
+
+/*
+ * Read what the transport has into the receive buffer
+ * \param timeout The time (ms) the transport may wait for data
+ *
+ * \returns The number of bytes added
+ */
+size_t MQTT::readRxBuffer(uint32_t timeout)
+{
+    // The packets given to the handlers that are running must stay where they are
+    if (_rxDepth == 0 && _rxStart > 0) {
+        memmove(_rxBuffer, &_rxBuffer[_rxStart], _rxEnd - _rxStart);
+        _rxEnd -= _rxStart;
+        _rxStart = 0;
+    }
+
+    if (_rxEnd >= sizeof(_rxBuffer)) {
+        return 0;
+    }
+
+    size_t len = _transport->receiveMQTTPacket(&_rxBuffer[_rxEnd], sizeof(_rxBuffer) - _rxEnd, timeout);
+
+    // Skip the rest of a packet that does not fit
+    size_t skip = (len < _rxDiscard) ? len : _rxDiscard;
+    if (skip > 0) {
+        _rxDiscard -= skip;
+        len -= skip;
+        memmove(&_rxBuffer[_rxEnd], &_rxBuffer[_rxEnd + skip], len);
+    }
+
+    _rxEnd += len;
+
+    return len;
+}
+
+/*
+ * Call handlePacket() for each complete packet in the receive buffer
+ *
+ * \returns The number of packets handled
+ */
+size_t MQTT::dispatchRxBuffer()
+{
+    size_t count = 0;
+
+    while (_rxStart < _rxEnd) {
+        size_t pckt_length;
+        int8_t status = getPacketLength(&_rxBuffer[_rxStart], _rxEnd - _rxStart, pckt_length);
+
+        if (status < 0) {
+            // Nothing after this can be trusted
+            errorPrintf(" malformed packet, receive buffer flushed");
+            _rxStart = _rxEnd;
+            break;
+        }
+        if (status == 0 || pckt_length > (_rxEnd - _rxStart)) {
+            if (status > 0 && pckt_length > sizeof(_rxBuffer) && _rxDepth == 0) {
+                uint8_t * pckt = &_rxBuffer[_rxStart];
+                uint8_t qos = 0;
+                uint16_t packet_id = 0;
+                if (((pckt[0] >> 4) & 0xF) == CPT_PUBLISH) {
+                    int8_t found = getPublishPacketId(pckt, _rxEnd - _rxStart, qos, packet_id);
+                    if (found == 0) {
+                        // Wait for the Packet Identifier
+                        break;
+                    }
+                    if (found < 0) {
+                        errorPrintf(" PUBLISH topic too long to acknowledge");
+                        qos = 0;
+                    }
+                }
+
+                errorPrintf(" packet of %u bytes skipped", (unsigned)pckt_length);
+                _rxDiscard = pckt_length - (_rxEnd - _rxStart);
+                _rxStart = _rxEnd;
+
+                // Acknowledged although it is dropped, the broker would send it again and again
+                if (qos == 1) {
+                    sendAck(CPT_PUBACK, packet_id);
+                } else if (qos == 2) {
+                    rememberInboundQos2(packet_id);
+                    sendAck(CPT_PUBREC, packet_id);
+                }
+            }
+            // Wait for the rest
+            break;
+        }
+
+        // Consumed before it is handled, in case the handler comes back here
+        uint8_t * pckt = &_rxBuffer[_rxStart];
+        _rxStart += pckt_length;
+
+        ++_rxDepth;
+        handlePacket(pckt, pckt_length);
+        --_rxDepth;
+        ++count;
+    }
+
+    if (_rxStart == _rxEnd && _rxDepth == 0) {
+        _rxStart = 0;
+        _rxEnd = 0;
+    }
+
+    return count;
+}
+
+/*
+ * Get the total length of the packet at the start of buf
+ *
+ * \returns 1 if pckt_length is set, 0 if the Remaining Length is not complete yet,
+ * -1 if it is malformed
+ */
+int8_t MQTT::getPacketLength(const uint8_t * buf, size_t len, size_t & pckt_length)
+{
+    uint32_t remaining = 0;
+
+    for (size_t ix = 1; ix <= 4; ++ix) {
+        if (ix >= len) {
+            return 0;
+        }
+        remaining |= (uint32_t)(buf[ix] & 0x7F) << (7 * (ix - 1));
+        if ((buf[ix] & 0x80) == 0) {
+            pckt_length = 1 + ix + remaining;
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Handle one complete incoming packet
+ *
+ * PUBLISH packets go to the publish handler and are acknowledged, the acknowledgements
+ * of outgoing publishes go to the in-flight table, the packet that waitForPacket() is
+ * waiting for is marked done, and anything else goes to the packet handler.
+ */
+void MQTT::handlePacket(uint8_t * pckt, size_t len)
+{
+    debugPrintf(" received packet:");
+    debugDump(pckt, len);
+
+    size_t nrBytesRL = 0;
+    uint32_t remaining = getRemainingLength(pckt + 1, nrBytesRL);
+    const uint8_t * body = pckt + 1 + nrBytesRL;
+    uint8_t type = (pckt[0] >> 4) & 0xF;
+    uint16_t packet_id = 0;
+
+    switch (type) {
+    case CPT_PUBLISH: {
+        MQTTPublishView view;
+        if (dissectPublishPacket(pckt, len, view)) {
+            // A QoS 2 message that was delivered already is only acknowledged again
+            bool deliver = (view.qos != 2) || rememberInboundQos2(view.packet_id);
+
+            if (deliver) {
+                if (_publishViewHandler) {
+                    _publishViewHandler(view);
+                } else if (_publishHandler) {
+                    // This handler always got the message NUL terminated. There is room for it:
+                    // the message moves down onto the spare byte after the topic.
+                    uint8_t * msg = (uint8_t *)view.msg - 1;
+                    memmove(msg, view.msg, view.msg_length);
+                    msg[view.msg_length] = '\0';
+                    _publishHandler(view.topic, msg, view.msg_length);
+                }
+            }
+
+            if (view.qos == 1) {
+                sendAck(CPT_PUBACK, view.packet_id);
+            } else if (view.qos == 2) {
+                sendAck(CPT_PUBREC, view.packet_id);
+            }
+        } else {
+            errorPrintf(" malformed PUBLISH");
+        }
+        return;
+    }
+    case CPT_PUBREL:
+        if (remaining >= 2) {
+            packet_id = get_uint16_be(body);
+            forgetInboundQos2(packet_id);
+            sendAck(CPT_PUBCOMP, packet_id);
+        }
+        return;
+    case CPT_PUBACK:
+    case CPT_PUBREC:
+    case CPT_PUBCOMP:
+        if (remaining >= 2) {
+            handleAck(type, get_uint16_be(body));
+        }
+        return;
+    case CPT_SUBACK:
+    case CPT_UNSUBACK:
+        if (remaining >= 2) {
+            packet_id = get_uint16_be(body);
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (!_waitDone && type == _waitType && packet_id == _waitPacketId) {
+        // CONNACK: flags, return code. SUBACK: packet identifier, return codes
+        if (type == CPT_CONNACK && remaining >= 2) {
+            _waitReturnCode = body[1];
+        } else if (type == CPT_SUBACK && remaining >= 3) {
+            _waitReturnCode = body[2];
+        } else {
+            _waitReturnCode = 0;
+        }
+        _waitDone = true;
+        return;
+    }
+
+    if (_packetHandler) {
+        _packetHandler(pckt, len);
+    }
+}
+
+/*
+ * Wait for a CONNACK, SUBACK or PINGRESP, handling all packets that come before it
+ * \param packet_id The Packet Identifier of the SUBACK, 0 for the others
+ *
+ * \returns false if it did not arrive in time. See _waitReturnCode for its return code.
+ */
+/*
+ * Get the QoS and Packet Identifier from the start of a PUBLISH that is at the
+ * start of the receive buffer, its Remaining Length is complete
+ *
+ * \returns 1 if found (the identifier is 0 for QoS 0), 0 if more bytes are
+ * needed, -1 if the identifier is beyond the receive buffer
+ */
+int8_t MQTT::getPublishPacketId(const uint8_t * buf, size_t len, uint8_t & qos, uint16_t & packet_id)
+{
+    qos = (buf[0] >> 1) & 0x3;
+    packet_id = 0;
+    if (qos == 0 || qos == 3) {
+        return 1;
+    }
+
+    size_t nrBytesRL = 0;
+    getRemainingLength(buf + 1, nrBytesRL);
+    size_t offset = 1 + nrBytesRL;
+    if (offset + 2 <= len) {
+        // Skip the topic
+        offset += 2 + get_uint16_be(buf + offset);
+        if (offset + 2 <= len) {
+            packet_id = get_uint16_be(buf + offset);
+            return 1;
+        }
+    }
+
+    return (offset + 2 > sizeof(_rxBuffer)) ? -1 : 0;
+}
+
+bool MQTT::waitForPacket(uint8_t type, uint16_t packet_id, uint32_t timeout)
+{
+    // A handler may be waiting for something else
+    uint8_t prevType = _waitType;
+    uint16_t prevPacketId = _waitPacketId;
+    bool prevDone = _waitDone;
+
+    _waitType = type;
+    _waitPacketId = packet_id;
+    _waitDone = false;
+
+    uint32_t start = millis();
+    dispatchRxBuffer();
+    while (!_waitDone) {
+        uint32_t elapsed = millis() - start;
+        if (elapsed >= timeout) {
+            break;
+        }
+        if (_rxDepth > 0 && _rxEnd >= sizeof(_rxBuffer)) {
+            // The packets of the handlers that are running fill the buffer, nothing more can come in
+            errorPrintf(" receive buffer full");
+            break;
+        }
+        if (readRxBuffer(timeout - elapsed) > 0) {
+            dispatchRxBuffer();
+        }
+    }
+
+    bool done = _waitDone;
+    _waitType = prevType;
+    _waitPacketId = prevPacketId;
+    _waitDone = prevDone;
+
+    return done;
+}
+
 /*
  * Set new Packet Identifier
  */
 void MQTT::newPacketIdentifier()
 {
-    ++_packetIdentifier;
-    if (_packetIdentifier == 0) {
-        // Cannot be zero
+    do {
         ++_packetIdentifier;
+        if (_packetIdentifier == 0) {
+            // Cannot be zero
+            ++_packetIdentifier;
+        }
+        // Nor the one of a message in flight
+    } while (findInflight(_packetIdentifier) >= 0);
+}
+
+/*
+ * Send a PUBACK, PUBREC, PUBREL or PUBCOMP packet
+ */
+bool MQTT::sendAck(uint8_t type, uint16_t packet_id)
+{
+    uint8_t pckt[4];
+    pckt[0] = (type << 4) | ((type == CPT_PUBREL) ? (2 << 0) : 0);  // reserved field of PUBREL must be 0010
+    pckt[1] = 2;
+    pckt[2] = highByte(packet_id);
+    pckt[3] = lowByte(packet_id);
+
+    debugPrintf(" ack %d for %u", type, packet_id);
+    return _transport->sendMQTTPacket(pckt, sizeof(pckt));
+}
+
+/*
+ * Handle a PUBACK, PUBREC or PUBCOMP for an outgoing QoS 1 or 2 publish
+ */
+void MQTT::handleAck(uint8_t type, uint16_t packet_id)
+{
+    int8_t ix = findInflight(packet_id);
+    if (ix < 0) {
+        debugPrintf(" unexpected ack %d for %u", type, packet_id);
+        if (type == CPT_PUBREC) {
+            // Perhaps our PUBREL got lost, e.g. before a restart
+            sendAck(CPT_PUBREL, packet_id);
+        }
+        return;
+    }
+
+    struct Inflight_s & inflight = _inflight[ix];
+    if (type == CPT_PUBACK && inflight.state == INFLIGHT_WAIT_PUBACK) {
+        releaseInflight(ix);
+    } else if (type == CPT_PUBREC && inflight.state != INFLIGHT_WAIT_PUBACK) {
+        // The message is not needed anymore, only the PUBREL can be sent again
+        releaseInflightData(ix);
+        inflight.state = INFLIGHT_WAIT_PUBCOMP;
+        inflight.sent_time = millis();
+        inflight.retries = 0;
+        sendAck(CPT_PUBREL, packet_id);
+    } else if (type == CPT_PUBCOMP && inflight.state == INFLIGHT_WAIT_PUBCOMP) {
+        releaseInflight(ix);
+    } else {
+        errorPrintf(" wrong ack %d for %u", type, packet_id);
+    }
+}
+
+/*
+ * Remember the Packet Identifier of an incoming QoS 2 publish
+ *
+ * \returns false if it was remembered already, i.e. it is a duplicate
+ */
+bool MQTT::rememberInboundQos2(uint16_t packet_id)
+{
+    for (size_t ix = 0; ix < MQTT_MAX_INFLIGHT; ++ix) {
+        if (_inboundQos2[ix] == packet_id) {
+            return false;
+        }
+    }
+
+    // When all are in use the oldest is overwritten
+    _inboundQos2[_inboundQos2Next] = packet_id;
+    _inboundQos2Next = (_inboundQos2Next + 1) % MQTT_MAX_INFLIGHT;
+
+    return true;
+}
+
+void MQTT::forgetInboundQos2(uint16_t packet_id)
+{
+    for (size_t ix = 0; ix < MQTT_MAX_INFLIGHT; ++ix) {
+        if (_inboundQos2[ix] == packet_id) {
+            _inboundQos2[ix] = 0;
+        }
+    }
+}
+
+/*
+ * Find the in-flight entry of a Packet Identifier, use 0 to find a free one
+ *
+ * \returns The index in _inflight, or -1
+ */
+int8_t MQTT::findInflight(uint16_t packet_id)
+{
+    for (size_t ix = 0; ix < MQTT_MAX_INFLIGHT; ++ix) {
+        if (packet_id == 0 ? (_inflight[ix].state == INFLIGHT_FREE)
+                : (_inflight[ix].state != INFLIGHT_FREE && _inflight[ix].packet_id == packet_id)) {
+            return ix;
+        }
+    }
+    return -1;
+}
+
+void MQTT::releaseInflight(uint8_t ix)
+{
+    releaseInflightData(ix);
+    memset(&_inflight[ix], 0, sizeof(_inflight[ix]));
+}
+
+/*
+ * Free the data of an in-flight entry, the data after it is moved down so
+ * _inflightData never fragments
+ */
+void MQTT::releaseInflightData(uint8_t ix)
+{
+    struct Inflight_s & inflight = _inflight[ix];
+    if (inflight.data_size == 0) {
+        return;
+    }
+
+    size_t end = inflight.data_offset + inflight.data_size;
+    memmove(_inflightData + inflight.data_offset, _inflightData + end, _inflightDataUsed - end);
+    _inflightDataUsed -= inflight.data_size;
+
+    for (size_t other = 0; other < MQTT_MAX_INFLIGHT; ++other) {
+        if (_inflight[other].data_size > 0 && _inflight[other].data_offset > inflight.data_offset) {
+            _inflight[other].data_offset -= inflight.data_size;
+        }
+    }
+
+    inflight.data_offset = 0;
+    inflight.data_size = 0;
+}
+
+/*
+ * Send again the PUBLISH (with DUP) or PUBREL of the messages in flight
+ * \param all Send all of them after a connect, not only those waiting longer than MQTT_RETRY_INTERVAL
+ *
+ * During a connection a message is sent again at most MQTT_MAX_RETRIES times, after
+ * that it waits for the next connect. It is not given up.
+ */
+void MQTT::retransmitInflight(bool all)
+{
+    if (_state != ST_MQTT_CONNECTED) {
+        return;
+    }
+
+    for (size_t ix = 0; ix < MQTT_MAX_INFLIGHT; ++ix) {
+        struct Inflight_s & inflight = _inflight[ix];
+        if (inflight.state == INFLIGHT_FREE) {
+            continue;
+        }
+        if (all) {
+            inflight.retries = 0;
+        } else if ((millis() - inflight.sent_time) < MQTT_RETRY_INTERVAL || inflight.retries >= MQTT_MAX_RETRIES) {
+            continue;
+        }
+
+        inflight.retries++;
+        inflight.sent_time = millis();
+
+        if (inflight.state == INFLIGHT_WAIT_PUBCOMP) {
+            sendAck(CPT_PUBREL, inflight.packet_id);
+        } else {
+            const uint8_t * data = _inflightData + inflight.data_offset;
+            sendPublishPacket((const char *)data, inflight.topic_length,
+                    data + inflight.topic_length + 1, inflight.msg_len,
+                    inflight.qos, inflight.retain, true, inflight.packet_id);
+        }
     }
 }
 
@@ -938,6 +1371,30 @@ uint32_t MQTT::getRemainingLength(const uint8_t *buf, size_t & nrBytes)
     return value;
 }
 
+/*
+ * Encode the "remaining length", see the note at the top
+ *
+ * \returns The number of bytes written to buf (1..4), 0 if the value is too large.
+ */
+size_t MQTT::putRemainingLength(uint8_t *buf, uint32_t value)
+{
+    if (value > MQTT_MAX_REMAINING_LENGTH) {
+        return 0;
+    }
+
+    size_t nrBytes = 0;
+    do {
+        uint8_t digit = value & 0x7F;
+        value >>= 7;
+        if (value > 0) {
+            digit |= 0x80;
+        }
+        buf[nrBytes++] = digit;
+    } while (value > 0);
+
+    return nrBytes;
+}
+
 uint16_t MQTT::get_uint16_be(const uint8_t * buf)
 {
     return (uint16_t)(buf[0] << 8) | buf[1];
@@ -954,15 +1411,15 @@ void MQTT::diagDumpBuffer(const uint8_t * buf, size_t len)
     for (size_t ix = 0; ix < len; ++ix) {
         if ((ix % 16) == 0) {
             if (ix != 0) {
-                debugPrintLn();
+                this->_diagStream->println();
             }
         }
         uint8_t val = buf[ix];
-        debugPrint((val >> 4), HEX);
-        debugPrint(val & 0xF, HEX);
+        this->_diagStream->print((val >> 4), HEX);
+        this->_diagStream->print(val & 0xF, HEX);
     }
     if (len > 0) {
-        debugPrintLn();
+        this->_diagStream->println();
     }
 }
 
@@ -29,12 +29,90 @@
 #include "Sodaq_MQTT_Interface.h"
 
 /*!
- * \brief The maximum length of a packet
+ * \brief The maximum length of the CONNECT packet
+ *
+ * It is assembled on the stack. The other packets are not limited by this,
+ * they are sent in parts, see Sodaq_MQTT_Interface::sendMQTTPacketv()
  */
-#define MQTT_MAX_PACKET_LENGTH  100
+#ifndef MQTT_MAX_PACKET_LENGTH
+#define MQTT_MAX_PACKET_LENGTH  256
+#endif
+
+/*!
+ * \brief The largest value of the Remaining Length (four bytes)
+ */
+#define MQTT_MAX_REMAINING_LENGTH  268435455UL
 #define MQTT_DEFAULT_KEEP_ALIVE  60
 
-class MQTTPacketInfo;
+/*!
+ * \brief The size of the receive buffer in which incoming packets are reassembled
+ *
+ * Larger packets are skipped.
+ */
+#ifndef MQTT_RX_BUFFER_SIZE
+#define MQTT_RX_BUFFER_SIZE  512
+#endif
+
+/*!
+ * \brief The time (ms) to wait for a CONNACK, SUBACK or PINGRESP
+ */
+#ifndef MQTT_RESPONSE_TIMEOUT
+#define MQTT_RESPONSE_TIMEOUT  20000
+#endif
+
+/*!
+ * \brief The number of QoS 1 and 2 publishes that can wait for their acknowledgement
+ *
+ * Also the number of incoming QoS 2 packet identifiers remembered until their PUBREL.
+ */
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT  8
+#endif
+
+/*!
+ * \brief The bytes kept for the messages in flight (topic, NUL and message each)
+ *
+ * A QoS 1 or 2 publish that does not fit until some are acknowledged fails.
+ */
+#ifndef MQTT_INFLIGHT_DATA_SIZE
+#define MQTT_INFLIGHT_DATA_SIZE  (MQTT_MAX_INFLIGHT * 128)
+#endif
+
+/*!
+ * \brief The time (ms) after which an unacknowledged PUBLISH or PUBREL is sent again
+ */
+#ifndef MQTT_RETRY_INTERVAL
+#define MQTT_RETRY_INTERVAL  10000
+#endif
+
+/*!
+ * \brief The number of times a PUBLISH or PUBREL is sent again during a connection
+ *
+ * After that it is only sent again after the next connect. It is never given up,
+ * it stays in flight until it is acknowledged.
+ */
+#ifndef MQTT_MAX_RETRIES
+#define MQTT_MAX_RETRIES  3
+#endif
+
+/*!
+ * \brief An incoming PUBLISH as passed to the publish view handler
+ *
+ * The topic and message point into the receive buffer and are only valid during
+ * the call of the handler. The topic is NUL terminated, the message is not.
+ */
+struct MQTTPublishView
+{
+    const char * topic;
+    size_t topic_length;
+    const uint8_t * msg;
+    size_t msg_length;
+    uint16_t packet_id;         // 0 for QoS 0
+    uint8_t qos;
+    bool dup;
+    bool retain;
+};
+
 class MQTT
 {
 public:
@@ -44,12 +122,16 @@ public:
     void setClientId(const char * id);
     void setTransport(Sodaq_MQTT_Interface * transport);
     void setKeepAlive(uint16_t x) { _keepAlive = x; }
+    uint16_t getKeepAlive() const { return _keepAlive; }
 
     bool publish(const char * topic, const uint8_t * msg, size_t msg_len, uint8_t qos = 0, uint8_t retain = 1);
     bool publish(const char * topic, const char * msg, uint8_t qos = 0, uint8_t retain = 1);
     bool subscribe(const char * topic, uint8_t qos = 0);
     bool ping();
+    size_t getInflightCount();
+    bool waitForAcks(uint32_t timeout = 10000);
     void setPublishHandler(void (*handler)(const char *topic, const uint8_t *msg, size_t msg_length));
+    void setPublishViewHandler(void (*handler)(const MQTTPublishView &view));
     void setPacketHandler(void (*handler)(uint8_t *pckt, size_t len));
     bool loop();
     bool availablePacket();
@@ -65,18 +147,35 @@ public:
 private:
     bool connect();
     bool disconnect();
-    size_t assemblePublishPacket(uint8_t * pckt, size_t size,
-            const char * topic, const uint8_t * msg, size_t msg_len, uint8_t qos = 0, uint8_t retain = 1);
-    size_t assembleSubscribePacket(uint8_t * pckt, size_t size,
-            const char * topic, uint8_t qos = 0);
+    size_t assemblePublishHeader(uint8_t * header, size_t size,
+            size_t topic_length, size_t msg_len, uint8_t qos = 0, uint8_t retain = 1, bool dup = false);
+    bool sendPublishPacket(const char * topic, size_t topic_length, const uint8_t * msg, size_t msg_len,
+            uint8_t qos, uint8_t retain, bool dup, uint16_t packet_id);
+    bool sendAck(uint8_t type, uint16_t packet_id);
+    void handleAck(uint8_t type, uint16_t packet_id);
+    bool rememberInboundQos2(uint16_t packet_id);
+    void forgetInboundQos2(uint16_t packet_id);
+    int8_t findInflight(uint16_t packet_id);
+    void releaseInflight(uint8_t ix);
+    void releaseInflightData(uint8_t ix);
+    void retransmitInflight(bool all);
+    void resetRxBuffer();
+    size_t readRxBuffer(uint32_t timeout);
+    size_t dispatchRxBuffer();
+    int8_t getPacketLength(const uint8_t * buf, size_t len, size_t & pckt_length);
+    int8_t getPublishPacketId(const uint8_t * buf, size_t len, uint8_t & qos, uint16_t & packet_id);
+    void handlePacket(uint8_t * pckt, size_t len);
+    bool waitForPacket(uint8_t type, uint16_t packet_id, uint32_t timeout = MQTT_RESPONSE_TIMEOUT);
+    size_t assembleSubscribeHeader(uint8_t * header, size_t size, size_t topic_length);
     size_t assembleConnectPacket(uint8_t * pckt, size_t size, uint16_t keepAlive);
     //size_t assembleDisconnectPacket(uint8_t * pckt, size_t size);
     size_t assemblePingreqPacket(uint8_t * pckt, size_t size);
-    bool dissectPublishPacket(const uint8_t * pckt, size_t len, MQTTPacketInfo &pckt_info);
+    bool dissectPublishPacket(uint8_t * pckt, size_t len, MQTTPublishView &view);
 
     void newPacketIdentifier();
 
     uint32_t getRemainingLength(const uint8_t *buf, size_t & nrBytes);
+    size_t putRemainingLength(uint8_t *buf, uint32_t value);
     uint16_t get_uint16_be(const uint8_t *buf);
 
     enum ControlPacketType_e {
@@ -102,6 +201,25 @@ private:
         ST_MQTT_DISCONNECTED,
         ST_TCP_CLOSED,
     };
+    enum Inflight_e {
+        INFLIGHT_FREE,
+        INFLIGHT_WAIT_PUBACK,
+        INFLIGHT_WAIT_PUBREC,
+        INFLIGHT_WAIT_PUBCOMP,
+    };
+    // An outgoing QoS 1 or 2 PUBLISH, waiting for its acknowledgement
+    struct Inflight_s {
+        uint16_t data_offset;       // In _inflightData: the topic, NUL and the message
+        uint16_t data_size;         // 0 after PUBREC
+        size_t topic_length;
+        size_t msg_len;
+        uint32_t sent_time;
+        uint16_t packet_id;
+        uint8_t state;              // Inflight_e
+        uint8_t qos;
+        uint8_t retain;
+        uint8_t retries;
+    };
     enum State_e _state;
     Sodaq_MQTT_Interface * _transport;
     const char * _server;
@@ -110,7 +228,28 @@ private:
     char * _password;
     char * _clientId;
     uint16_t _packetIdentifier;
+    struct Inflight_s _inflight[MQTT_MAX_INFLIGHT];
+    // The data of the messages in flight, packed from the start
+    uint8_t _inflightData[MQTT_INFLIGHT_DATA_SIZE];
+    size_t _inflightDataUsed;
+    // The packet identifiers of incoming QoS 2 publishes, until their PUBREL (0 is unused)
+    uint16_t _inboundQos2[MQTT_MAX_INFLIGHT];
+    uint8_t _inboundQos2Next;
+
+    // Incoming packets, complete ones are in [_rxStart, _rxEnd)
+    uint8_t _rxBuffer[MQTT_RX_BUFFER_SIZE];
+    size_t _rxStart;
+    size_t _rxEnd;
+    uint32_t _rxDiscard;        // The bytes still to skip of a packet too large for the buffer
+    uint8_t _rxDepth;           // Handlers running, the buffer is not compacted meanwhile
+
+    // The packet waitForPacket() is waiting for
+    uint8_t _waitType;
+    uint16_t _waitPacketId;
+    bool _waitDone;
+    uint8_t _waitReturnCode;    // CONNACK or (first) SUBACK return code
     void (*_publishHandler)(const char *topic, const uint8_t *msg, size_t msg_length);
+    void (*_publishViewHandler)(const MQTTPublishView &view);
     void (*_packetHandler)(uint8_t *pckt, size_t len);
     uint16_t _keepAlive;
 
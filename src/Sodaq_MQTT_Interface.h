@@ -24,6 +24,23 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * The size of the buffer the default sendMQTTPacketv() gathers the parts of a packet in
+ */
+#ifndef MQTT_SEND_CHUNK_SIZE
+#define MQTT_SEND_CHUNK_SIZE 128
+#endif
+
+/*
+ * One part of a packet for sendMQTTPacketv()
+ */
+struct MQTTIoVec
+{
+    const uint8_t * data;
+    size_t len;
+};
 
 class Sodaq_MQTT_Interface
 {
@@ -31,6 +48,43 @@ public:
     virtual bool openMQTT(const char * server, uint16_t port = 1883) = 0;
     virtual bool closeMQTT(bool switchOff=true) = 0;
     virtual bool sendMQTTPacket(uint8_t * pckt, size_t len) = 0;
+
+    /*
+     * Send a packet given as "count" parts, e.g. header, topic and payload, without the
+     * caller having to copy them into one buffer.
+     * By default the parts are gathered in chunks of MQTT_SEND_CHUNK_SIZE for sendMQTTPacket(),
+     * a transport that can write the parts directly should override this.
+     */
+    virtual bool sendMQTTPacketv(const MQTTIoVec * iov, size_t count)
+    {
+        uint8_t chunk[MQTT_SEND_CHUNK_SIZE];
+        size_t used = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t * data = iov[i].data;
+            size_t len = iov[i].len;
+
+            while (len > 0) {
+                size_t n = sizeof(chunk) - used;
+                if (n > len) {
+                    n = len;
+                }
+                memcpy(chunk + used, data, n);
+                used += n;
+                data += n;
+                len -= n;
+
+                if (used == sizeof(chunk)) {
+                    if (!sendMQTTPacket(chunk, used)) {
+                        return false;
+                    }
+                    used = 0;
+                }
+            }
+        }
+
+        return (used == 0) || sendMQTTPacket(chunk, used);
+    }
     virtual size_t receiveMQTTPacket(uint8_t * pckt, size_t size, uint32_t timeout = 20000) = 0;
     virtual size_t availableMQTTPacket() = 0;
     virtual bool isAliveMQTT() = 0;
@@ -31,10 +31,10 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "Sodaq_R4X.h"
 #include "Sodaq_wdt.h"
+#include "Sodaq_Log.h"
+#include "Sodaq_HexWriter.h"
 #include "time.h"
 
-#define DEBUG
-
 #define EPOCH_TIME_OFF             946684800  /* This is 1st January 2000, 00:00:00 in epoch time */
 #define EPOCH_TIME_YEAR_OFF        100        /* years since 1900 */
 #define ATTACH_TIMEOUT             180000
@@ -42,6 +42,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define CGACT_TIMEOUT              150000
 #define COPS_TIMEOUT               180000
 #define ISCONNECTED_CSQ_TIMEOUT    10000
+#define REATTACH_TIMEOUT           60000
 #define REBOOT_DELAY               1250
 #define REBOOT_TIMEOUT             15000
 #define SOCKET_CLOSE_TIMEOUT       120000
@@ -49,6 +50,23 @@ POSSIBILITY OF SUCH DAMAGE.
 #define SOCKET_WRITE_TIMEOUT       120000
 #define UMQTT_TIMEOUT              60000
 #define POWER_OFF_DELAY            5000
+#define BAUDRATE_SETTLE_DELAY      100
+#define POWER_ON_TIMEOUT           10000
+#define POWER_ON_PROBE_INTERVAL    250
+#define POWER_ON_PROBE_TIMEOUT     100
+
+// The number of commands that must succeed at a new baud rate before it is kept
+#ifndef SODAQ_R4X_BAUDRATE_VERIFY_COUNT
+#define SODAQ_R4X_BAUDRATE_VERIFY_COUNT 3
+#endif
+
+// The first and the longest delay between the retries of the polling loops
+#define ATTACH_BACKOFF_MIN         500
+#define ATTACH_BACKOFF_MAX         8000
+#define CSQ_BACKOFF_MIN            500
+#define CSQ_BACKOFF_MAX            5000
+#define HTTP_BACKOFF_MIN           50
+#define HTTP_BACKOFF_MAX           5000
 
 #define SODAQ_GSM_TERMINATOR "\r\n"
 #define SODAQ_GSM_MODEM_DEFAULT_INPUT_BUFFER_SIZE 1024
@@ -77,10 +95,13 @@ POSSIBILITY OF SUCH DAMAGE.
 #define STR_HELPER(x) #x
 #define STR(x) STR_HELPER(x)
 
-#ifdef DEBUG
+#define errorPrintf(...)  SODAQ_LOG_ERROR(_diagStream, __VA_ARGS__)
+#define infoPrintf(...)   SODAQ_LOG_INFO(_diagStream, __VA_ARGS__)
+#define debugPrintf(...)  SODAQ_LOG_DEBUG(_diagStream, __VA_ARGS__)
+
+#if SODAQ_LOG_LEVEL >= SODAQ_LOG_LEVEL_DEBUG
 #define debugPrint(...)   { if (_diagStream) _diagStream->print(__VA_ARGS__); }
 #define debugPrintln(...) { if (_diagStream) _diagStream->println(__VA_ARGS__); }
-#warning "Debug mode is ON"
 #else
 #define debugPrint(...)
 #define debugPrintln(...)
@@ -103,6 +124,109 @@ static uint8_t httpRequestMapping[] = {
     3, // 4 PUT
 };
 
+// The units of the PSM timers (3GPP TS 24.008 GPRS Timer 3 and GPRS Timer 2), sorted by length.
+// A timer is encoded as the 3-bit unit code followed by a 5-bit multiplier.
+struct PsmTimerUnit {
+    uint32_t seconds;
+    uint8_t  code;
+};
+
+static const PsmTimerUnit psmTauUnits[] = {
+    { 2,       3 },
+    { 30,      4 },
+    { 60,      5 },
+    { 600,     0 },
+    { 3600,    1 },
+    { 36000,   2 },
+    { 1152000, 6 },
+};
+
+static const PsmTimerUnit psmActiveTimeUnits[] = {
+    { 2,   0 },
+    { 60,  1 },
+    { 360, 2 },
+};
+
+#define PSM_TIMER_DEACTIVATED 7
+
+// Writes the timer as an 8-bit string into "bits", rounding up to the nearest value that can be encoded.
+static void encodePsmTimer(uint32_t seconds, const PsmTimerUnit* units, uint8_t count, char* bits)
+{
+    uint8_t value = (PSM_TIMER_DEACTIVATED << 5);
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t multiplier = (seconds + units[i].seconds - 1) / units[i].seconds;
+
+        if (multiplier <= 31 || i == count - 1) {
+            value = (units[i].code << 5) | min(multiplier, (uint32_t)31);
+            break;
+        }
+    }
+
+    for (uint8_t i = 0; i < 8; i++) {
+        bits[i] = (value & (0x80 >> i)) ? '1' : '0';
+    }
+
+    bits[8] = '\0';
+}
+
+// Returns the timer encoded in the 8-bit string "bits" in seconds, or 0 if it is deactivated or invalid.
+static uint32_t decodePsmTimer(const char* bits, const PsmTimerUnit* units, uint8_t count)
+{
+    uint8_t value = 0;
+
+    for (uint8_t i = 0; i < 8; i++) {
+        if (bits[i] != '0' && bits[i] != '1') {
+            return 0;
+        }
+
+        value = (value << 1) | (bits[i] - '0');
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (units[i].code == (value >> 5)) {
+            return units[i].seconds * (value & 0x1F);
+        }
+    }
+
+    return 0;
+}
+
+// Copies the field at "index" of the comma separated "str" into "buffer", without quotes.
+// Commas between quotes do not separate fields. Returns false if there is no such field.
+static bool getCsvField(const char* str, uint8_t index, char* buffer, size_t size)
+{
+    bool quoted = false;
+
+    for (; *str && index > 0; str++) {
+        if (*str == '"') {
+            quoted = !quoted;
+        }
+        else if (*str == ',' && !quoted) {
+            index--;
+        }
+    }
+
+    if (index > 0) {
+        return false;
+    }
+
+    size_t len = 0;
+
+    for (; *str && (*str != ',' || quoted); str++) {
+        if (*str == '"') {
+            quoted = !quoted;
+        }
+        else if (len < size - 1) {
+            buffer[len++] = *str;
+        }
+    }
+
+    buffer[len] = '\0';
+
+    return true;
+}
+
 
 /******************************************************************************
 * Main
@@ -119,6 +243,10 @@ Sodaq_R4X::Sodaq_R4X() :
     _inputBuffer         = 0;
     _inputBufferSize     = SODAQ_GSM_MODEM_DEFAULT_INPUT_BUFFER_SIZE;
     _lastRSSI            = 0;
+    _lastCellId          = 0;
+    _telemetryHead       = 0;
+    _telemetryCount      = 0;
+    memset(_telemetrySummary, 0, sizeof(_telemetrySummary));
     _minRSSI             = -113;  // dBm
     _onoff               = 0;
     _mqttLoginResult     = -1;
@@ -126,9 +254,43 @@ Sodaq_R4X::Sodaq_R4X() :
     _mqttSubscribeReason = -1;
     _networkStatusLED = 0;
     _pin                 = 0;
+    _psmState            = -1;
+    _registrationStatus  = -1;
+    _psmTau              = 0;
+    _psmActiveTime       = 0;
+    _edrxActType         = 0;
+    _edrxCycle           = EDRX_DISABLED;
+    _edrxPagingWindow    = 0;
+    _commandCount        = 0;
+    _lastCommandHandle   = 0;
+    _commandStarted      = false;
+    _sendingCommand      = false;
+    _completedCallback   = NULL;
+    _rxHead              = 0;
+    _rxTail              = 0;
+    _socketBinaryMode    = false;
+    _urcHandlerCount     = 0;
+    _execCommand         = NULL;
+
+    _powerOnState          = PowerOnIdle;
+    _powerOnStateMillis    = 0;
+    _powerOnPulse          = 0;
+    _powerOnProbeMillis    = 0;
+    _baudrateChangeHandler = 0;
+    _baudrate              = getDefaultBaudrate();
+    _failedBaudrate        = 0;
+    _hostBaudrate          = getDefaultBaudrate();
+
+    invalidateConfigCache();
+
+    memset(&_lastConnect, 0, sizeof(_lastConnect));
+    memset(&_identity, 0, sizeof(_identity));
 
     memset(_socketClosedBit,    1, sizeof(_socketClosedBit));
     memset(_socketPendingBytes, 0, sizeof(_socketPendingBytes));
+    memset(_socketIsUDP,        0, sizeof(_socketIsUDP));
+    memset(_socketStats,        0, sizeof(_socketStats));
+    memset(_socketRxBuffer,     0, sizeof(_socketRxBuffer));
 }
 
 // Initializes the modem instance. Sets the modem stream and the on-off power pins.
@@ -146,41 +308,217 @@ void Sodaq_R4X::init(Sodaq_OnOffBee* onoff, Stream& stream, uint8_t cid)
 
 // Turns the modem on and returns true if successful.
 bool Sodaq_R4X::on()
+{
+    beginPowerOn();
+
+    PowerOnStates state;
+
+    while (((state = pollPowerOn()) != PowerOnReady) && (state != PowerOnFailed)) {
+        idleWait(10);
+    }
+
+    if (state == PowerOnFailed) {
+        debugPrintln("Error: No Reply from Modem");
+        return false;
+    }
+
+    return isOn(); // this essentially means isOn() && isAlive()
+}
+
+void Sodaq_R4X::beginPowerOn()
 {
     _startOn = millis();
 
+    _powerOnStateMillis = millis();
+    _powerOnProbeMillis = 0;
+
     if (!isOn() && _onoff) {
-        _onoff->on();
+        // the modem starts from its defaults after being powered on
+        invalidateConfigCache();
+        changeHostBaudrate(getDefaultBaudrate());
+
+        _powerOnPulse = _onoff->beginOn();
+        _powerOnState = PowerOnPulse;
     }
+    else {
+        _powerOnState = PowerOnBooting;
+    }
+}
 
-    // wait for power up
-    bool timeout = true;
-    for (uint8_t i = 0; i < 10; i++) {
-        if (isAlive()) {
-            timeout = false;
-            break;
+PowerOnStates Sodaq_R4X::pollPowerOn()
+{
+    if (_powerOnState == PowerOnPulse) {
+        if (!is_timedout(_powerOnStateMillis, _powerOnPulse)) {
+            return _powerOnState;
         }
+
+        _onoff->endOn();
+
+        _powerOnState = PowerOnBooting;
+        _powerOnStateMillis = millis();
     }
 
-    if (timeout) {
-        debugPrintln("Error: No Reply from Modem");
-        return false;
+    if (_powerOnState != PowerOnBooting) {
+        return _powerOnState;
+    }
+
+    if (is_timedout(_powerOnStateMillis, POWER_ON_TIMEOUT)) {
+        _powerOnState = PowerOnFailed;
+        return _powerOnState;
+    }
+
+    // the UART can't answer before V_INT is up, if the board tells
+    if ((_onoff && (_onoff->isPowered() == TriBoolFalse)) ||
+            ((_powerOnProbeMillis != 0) && !is_timedout(_powerOnProbeMillis, POWER_ON_PROBE_INTERVAL))) {
+        return _powerOnState;
+    }
+
+    _powerOnProbeMillis = millis();
+
+    if (!syncBaudrate(POWER_ON_PROBE_TIMEOUT)) {
+        return _powerOnState;
     }
 
     // Extra read just to clear the input stream
     readResponse(NULL, 0, NULL, 250);
 
-    return isOn(); // this essentially means isOn() && isAlive()
+    restoreBaudrate();
+
+    _powerOnState = PowerOnReady;
+
+    return _powerOnState;
+}
+
+bool Sodaq_R4X::setBaudrate(uint32_t baudrate)
+{
+    if (!_baudrateChangeHandler) {
+        debugPrintln("[setBaudrate] no baud rate change handler set");
+        return false;
+    }
+
+    _baudrate = baudrate;
+
+    if (!isOn()) {
+        return true; // applied by on()
+    }
+
+    if ((_config.baudrate == baudrate) && (_hostBaudrate == baudrate)) {
+        return true;
+    }
+
+    print("AT+IPR=");
+    println(baudrate);
+
+    if (readResponse() != GSMResponseOK) {
+        return false; // kept as requested, on() and reboot() try again
+    }
+
+    // the modem switches after the OK
+    sodaq_wdt_safe_delay(BAUDRATE_SETTLE_DELAY);
+    changeHostBaudrate(baudrate);
+
+    uint8_t verified = 0;
+
+    while ((verified < SODAQ_R4X_BAUDRATE_VERIFY_COUNT) && isAlive()) {
+        verified++;
+    }
+
+    if (verified == SODAQ_R4X_BAUDRATE_VERIFY_COUNT) {
+        _config.baudrate = baudrate;
+        _failedBaudrate  = 0;
+        return true;
+    }
+
+    // the link is not stable at this rate, go back to the default on both sides
+    debugPrintln("[setBaudrate] the new baud rate is not stable, falling back to the default");
+
+    _baudrate = getDefaultBaudrate();
+
+    print("AT+IPR=");
+    println(_baudrate);
+    readResponse(NULL, 0, NULL, 500);
+
+    sodaq_wdt_safe_delay(BAUDRATE_SETTLE_DELAY);
+    changeHostBaudrate(_baudrate);
+
+    if (isAlive()) {
+        _config.baudrate = _baudrate;
+        _failedBaudrate  = 0;
+    }
+    else {
+        // the modem may not have taken the AT+IPR at the unstable rate, syncBaudrate() tries that rate too
+        _config.baudrate = 0;
+        _failedBaudrate  = baudrate;
+    }
+
+    return false;
+}
+
+void Sodaq_R4X::changeHostBaudrate(uint32_t baudrate)
+{
+    if (!_baudrateChangeHandler || (_hostBaudrate == baudrate)) {
+        return;
+    }
+
+    _modemStream->flush();
+    _baudrateChangeHandler(baudrate);
+    _hostBaudrate = baudrate;
+
+    // whatever was received at the old rate is garbage now
+    _rxTail = _rxHead;
+}
+
+// Returns true if the modem replies to "AT", trying the other known baud rate
+// (the requested or the default one) if it does not reply at the current one.
+bool Sodaq_R4X::syncBaudrate(uint32_t timeout)
+{
+    if (execCommand(STR_AT, timeout)) {
+        return true;
+    }
+
+    if (!_baudrateChangeHandler) {
+        return false;
+    }
+
+    // the modem runs at the requested rate, the default one, or a rate that failed verification
+    uint32_t candidates[] = { _baudrate, getDefaultBaudrate(), _failedBaudrate };
+
+    for (uint8_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if ((candidates[i] == 0) || (candidates[i] == _hostBaudrate)) {
+            continue;
+        }
+
+        changeHostBaudrate(candidates[i]);
+
+        if (execCommand(STR_AT, timeout)) {
+            _config.baudrate = _hostBaudrate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Applies the rate requested with setBaudrate() again if the modem is not running at it.
+bool Sodaq_R4X::restoreBaudrate()
+{
+    if (!_baudrateChangeHandler || (_baudrate == getDefaultBaudrate() && _hostBaudrate == _baudrate)) {
+        return true;
+    }
+
+    return setBaudrate(_baudrate);
 }
 
 // Turns the modem off and returns true if successful.
 bool Sodaq_R4X::off()
 {
+    flushCommands();
+
     // Safety command to shutdown, response is ignored
     if (isOn()) {
         println("AT+CPWROFF");
         readResponse(NULL, 0, NULL, 1000);
-        sodaq_wdt_safe_delay(POWER_OFF_DELAY);
+        waitForPowerDown(POWER_OFF_DELAY);
     }
 
     // No matter if it is on or off, turn it off.
@@ -188,7 +526,10 @@ bool Sodaq_R4X::off()
         _onoff->off();
     }
 
+    _powerOnState = PowerOnIdle;
+
     _mqttLoginResult = -1;
+    invalidateConfigCache();
 
     return !isOn();
 }
@@ -196,17 +537,27 @@ bool Sodaq_R4X::off()
 bool Sodaq_R4X::connect(const char* apn, const char* uratSelect, uint8_t mnoProfile,
     const char* operatorSelect, const char* bandMaskLTE, const char* bandMaskNB)
 {
+    _lastConnect.apn            = apn;
+    _lastConnect.urat           = uratSelect;
+    _lastConnect.mnoProfile     = mnoProfile;
+    _lastConnect.operatorSelect = operatorSelect;
+    _lastConnect.bandMaskLTE    = bandMaskLTE;
+    _lastConnect.bandMaskNB     = bandMaskNB;
+
     if (!on()) {
         return false;
     }
 
     purgeAllResponsesRead();
 
-    println("AT+CPSMS=0");
-    if (readResponse() != GSMResponseOK) {
+    if (!applyPowerSavingMode()) {
         return false;
     }
-    
+
+    if (!applyEdrx()) {
+        return false;
+    }
+
     if (!setVerboseErrors(true)) {
         return false;
     }
@@ -215,7 +566,7 @@ bool Sodaq_R4X::connect(const char* apn, const char* uratSelect, uint8_t mnoProf
         return false;
     }
 
-    if (!execCommand("ATE0")) {
+    if (!setEchoOff()) {
         return false;
     }
 
@@ -271,7 +622,40 @@ bool Sodaq_R4X::connect(const char* apn, const char* uratSelect, uint8_t mnoProf
 
 bool Sodaq_R4X::connect(const char* apn, const char* urat, const char* bandMask)
 {
-    connect(apn, urat, SIM_ICCID, AUTOMATIC_OPERATOR, BAND_MASK_UNCHANGED, bandMask);
+    return connect(apn, urat, SIM_ICCID, AUTOMATIC_OPERATOR, BAND_MASK_UNCHANGED, bandMask);
+}
+
+bool Sodaq_R4X::reconnect()
+{
+    if (_lastConnect.apn == 0) {
+        return false;
+    }
+
+    if (isOn() && isAlive()) {
+        int8_t status = queryRegistrationStatus();
+
+        // registered, home network or roaming
+        if (status == 1 || status == 5) {
+            if (isContextActive() && isDefinedIP4()) {
+                debugPrintln("[reconnect] connection is still up");
+                return true;
+            }
+
+            if (execCommand("AT+CGACT=1", CGACT_TIMEOUT) && isDefinedIP4()) {
+                debugPrintln("[reconnect] reactivated the PDP context");
+                return true;
+            }
+        }
+        else if (checkCFUN() && attachGprs(REATTACH_TIMEOUT)) {
+            debugPrintln("[reconnect] re-attached");
+            return true;
+        }
+    }
+
+    debugPrintln("[reconnect] falling back to a full connect");
+
+    return connect(_lastConnect.apn, _lastConnect.urat, _lastConnect.mnoProfile, _lastConnect.operatorSelect,
+        _lastConnect.bandMaskLTE, _lastConnect.bandMaskNB);
 }
 
 // Disconnects the modem from the network.
@@ -288,23 +672,21 @@ bool Sodaq_R4X::disconnect()
 bool Sodaq_R4X::attachGprs(uint32_t timeout)
 {
     uint32_t start = millis();
-    uint32_t delay_count = 500;
+    Backoff backoff = { ATTACH_BACKOFF_MIN, ATTACH_BACKOFF_MAX };
 
     while (!is_timedout(start, timeout)) {
         if (isAttached()) {
             if (isDefinedIP4() || (execCommand("AT+CGACT=1", CGACT_TIMEOUT) && isDefinedIP4())) {
+                recordTelemetry(TelemetryAttach, start, true);
                 return true;
             }
         }
 
-        sodaq_wdt_safe_delay(delay_count);
-
-        // Next time wait a little longer, but not longer than 5 seconds
-        if (delay_count < 5000) {
-            delay_count += 1000;
-        }
+        backoffWait(&backoff);
     }
 
+    recordTelemetry(TelemetryAttach, start, false);
+
     return false;
 }
 
@@ -342,6 +724,10 @@ bool Sodaq_R4X::getCCID(char* buffer, size_t size)
         return false;
     }
 
+    if (copyIdentityField(_identity.valid, _identity.ccid, buffer, size)) {
+        return true;
+    }
+
     println("AT+CCID");
 
     return (readResponse(buffer, size, "+CCID: ") == GSMResponseOK) && (strlen(buffer) > 0);
@@ -356,6 +742,10 @@ bool Sodaq_R4X::getIMSI(char* buffer, size_t size)
         return false;
     }
 
+    if (copyIdentityField(_identity.valid, _identity.imsi, buffer, size)) {
+        return true;
+    }
+
     return (execCommand("AT+CIMI", DEFAULT_READ_MS, buffer, size) == GSMResponseOK) && (strlen(buffer) > 0) && (atoll(buffer) > 0);
 }
 
@@ -420,9 +810,7 @@ bool Sodaq_R4X::getOperatorInfoString(char* buffer, size_t size)
 
 bool Sodaq_R4X::getCellInfo(uint16_t* tac, uint32_t* cid, uint16_t* urat)
 {
-    println("AT+CEREG=2");
-
-    if (readResponse() != GSMResponseOK) {
+    if (!setCeregMode(2)) {
         return false;
     }
 
@@ -433,6 +821,8 @@ bool Sodaq_R4X::getCellInfo(uint16_t* tac, uint32_t* cid, uint16_t* urat)
 
     if ((readResponse(responseBuffer, sizeof(responseBuffer), "+CEREG: ") == GSMResponseOK) && (strlen(responseBuffer) > 0)) {
         if (sscanf(responseBuffer, "2,%*d,\"%hx\",\"%x\",%hi", tac, cid, urat) == 3) {
+            _lastCellId = *cid;
+
             switch(*urat) {
                 case 7:
                 case 8: *urat = 7; break;
@@ -455,6 +845,7 @@ bool Sodaq_R4X::getCellInfo(uint16_t* tac, uint32_t* cid, uint16_t* urat)
 
             if ((readResponse(responseBuffer, sizeof(responseBuffer), "+CGREG: ") == GSMResponseOK) && (strlen(responseBuffer) > 0)) {
                 if (sscanf(responseBuffer, "2,%*d,\"%hx\",\"%x\"", tac, cid) == 2) {
+                    _lastCellId = *cid;
                     *urat = 9;
                     return true;
                 }
@@ -465,6 +856,203 @@ bool Sodaq_R4X::getCellInfo(uint16_t* tac, uint32_t* cid, uint16_t* urat)
     return false;
 }
 
+void Sodaq_R4X::recordTelemetry(uint8_t operation, uint32_t startMillis, bool success)
+{
+    TelemetryRecord* record = &_telemetry[_telemetryHead];
+
+    record->time      = millis();
+    record->duration  = record->time - startMillis;
+    record->cellId    = _lastCellId;
+    record->rssi      = _lastRSSI;
+    record->operation = operation;
+    record->success   = success;
+
+    _telemetryHead = (_telemetryHead + 1) % SODAQ_R4X_TELEMETRY_SIZE;
+
+    if (_telemetryCount < SODAQ_R4X_TELEMETRY_SIZE) {
+        _telemetryCount++;
+    }
+
+    if (operation < TelemetryOperationsMAX) {
+        TelemetrySummary* summary = &_telemetrySummary[operation];
+
+        summary->totalDuration += record->duration;
+        summary->count++;
+
+        if (!success) {
+            summary->failures++;
+        }
+    }
+}
+
+const TelemetrySummary* Sodaq_R4X::getTelemetrySummary(uint8_t operation) const
+{
+    if (operation >= TelemetryOperationsMAX) {
+        return NULL;
+    }
+
+    return &_telemetrySummary[operation];
+}
+
+void Sodaq_R4X::clearTelemetry()
+{
+    _telemetryCount = 0;
+    memset(_telemetrySummary, 0, sizeof(_telemetrySummary));
+}
+
+const TelemetryRecord* Sodaq_R4X::getTelemetryRecord(uint8_t index) const
+{
+    if (index >= _telemetryCount) {
+        return NULL;
+    }
+
+    return &_telemetry[(_telemetryHead + SODAQ_R4X_TELEMETRY_SIZE - _telemetryCount + index) % SODAQ_R4X_TELEMETRY_SIZE];
+}
+
+bool Sodaq_R4X::setPowerSavingMode(uint32_t tau, uint32_t activeTime)
+{
+    _psmTau        = tau;
+    _psmActiveTime = activeTime;
+
+    if (_modemStream == 0 || !isOn()) {
+        return true;
+    }
+
+    return applyPowerSavingMode();
+}
+
+bool Sodaq_R4X::setEdrx(uint8_t cycle, uint8_t pagingWindow, uint8_t actType)
+{
+    _edrxActType      = actType;
+    _edrxCycle        = cycle;
+    _edrxPagingWindow = pagingWindow;
+
+    if (_modemStream == 0 || !isOn()) {
+        return true;
+    }
+
+    return applyEdrx();
+}
+
+bool Sodaq_R4X::getPowerSavingTimers(uint32_t* tau, uint32_t* activeTime)
+{
+    // mode 4 adds the granted PSM timers to the +CEREG response
+    if (!setCeregMode(4)) {
+        return false;
+    }
+
+    println("AT+CEREG?");
+
+    char buffer[96];
+
+    if (readResponse(buffer, sizeof(buffer), "+CEREG: ") != GSMResponseOK) {
+        return false;
+    }
+
+    // 4,<stat>,<tac>,<ci>,<AcT>,<cause_type>,<reject_cause>,<Active-Time>,<Periodic-TAU>
+    char bits[9];
+
+    *activeTime = getCsvField(buffer, 7, bits, sizeof(bits)) ?
+        decodePsmTimer(bits, psmActiveTimeUnits, sizeof(psmActiveTimeUnits) / sizeof(psmActiveTimeUnits[0])) : 0;
+
+    *tau = getCsvField(buffer, 8, bits, sizeof(bits)) ?
+        decodePsmTimer(bits, psmTauUnits, sizeof(psmTauUnits) / sizeof(psmTauUnits[0])) : 0;
+
+    return true;
+}
+
+bool Sodaq_R4X::applyPowerSavingMode()
+{
+    if (_psmTau == 0) {
+        if (_config.psmDisabled != TriBoolTrue) {
+            println("AT+CPSMS=0");
+
+            if (readResponse() != GSMResponseOK) {
+                return false;
+            }
+
+            _config.psmDisabled = TriBoolTrue;
+        }
+
+        return true;
+    }
+
+    if ((_config.psmDisabled != TriBoolFalse) || (_config.psmTau != _psmTau) || (_config.psmActiveTime != _psmActiveTime)) {
+        char tau[9];
+        char activeTime[9];
+
+        encodePsmTimer(_psmTau, psmTauUnits, sizeof(psmTauUnits) / sizeof(psmTauUnits[0]), tau);
+        encodePsmTimer(_psmActiveTime, psmActiveTimeUnits, sizeof(psmActiveTimeUnits) / sizeof(psmActiveTimeUnits[0]), activeTime);
+
+        print("AT+CPSMS=1,,,\"");
+        print(tau);
+        print("\",\"");
+        print(activeTime);
+        println('"');
+
+        if (readResponse() != GSMResponseOK) {
+            _config.psmDisabled = TriBoolUndefined;
+            return false;
+        }
+
+        _config.psmDisabled   = TriBoolFalse;
+        _config.psmTau        = _psmTau;
+        _config.psmActiveTime = _psmActiveTime;
+    }
+
+    // report entering and leaving PSM (+UUPSMR) and registration changes (+CEREG)
+    if (_config.psmUrcEnabled != TriBoolTrue) {
+        if (!execCommand("AT+UPSMR=1")) {
+            return false;
+        }
+
+        _config.psmUrcEnabled = TriBoolTrue;
+    }
+
+    return setCeregMode(4);
+}
+
+bool Sodaq_R4X::applyEdrx()
+{
+    if (_edrxActType == 0) {
+        return true; // never requested, leave the modem setting alone
+    }
+
+    if (_edrxCycle == EDRX_DISABLED) {
+        return execCommand("AT+CEDRXS=3");
+    }
+
+    char bits[5];
+
+    for (uint8_t i = 0; i < 4; i++) {
+        bits[i] = (_edrxCycle & (0x08 >> i)) ? '1' : '0';
+    }
+
+    bits[4] = '\0';
+
+    print("AT+CEDRXS=1,");
+    print(_edrxActType);
+    print(",\"");
+    print(bits);
+    println('"');
+
+    if (readResponse() != GSMResponseOK) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < 4; i++) {
+        bits[i] = (_edrxPagingWindow & (0x08 >> i)) ? '1' : '0';
+    }
+
+    print("AT+UPTW=");
+    print(_edrxActType);
+    print(",\"");
+    print(bits);
+    println('"');
+
+    return (readResponse() == GSMResponseOK);
+}
+
 bool Sodaq_R4X::getEpoch(uint32_t* epoch)
 {
     println("AT+CCLK?");
@@ -493,6 +1081,10 @@ bool Sodaq_R4X::getFirmwareVersion(char* buffer, size_t size)
         return false;
     }
 
+    if (copyIdentityField(_identity.valid, _identity.firmwareVersion, buffer, size)) {
+        return true;
+    }
+
     return execCommand("AT+CGMR", DEFAULT_READ_MS, buffer, size);
 }
 
@@ -502,6 +1094,10 @@ bool Sodaq_R4X::getFirmwareRevision(char* buffer, size_t size)
         return false;
     }
 
+    if (copyIdentityField(_identity.valid, _identity.firmwareRevision, buffer, size)) {
+        return true;
+    }
+
     return execCommand("ATI9", DEFAULT_READ_MS, buffer, size);
 }
 
@@ -514,9 +1110,126 @@ bool Sodaq_R4X::getIMEI(char* buffer, size_t size)
         return false;
     }
 
+    if (copyIdentityField(_identity.valid, _identity.imei, buffer, size)) {
+        return true;
+    }
+
     return (execCommand("AT+CGSN", DEFAULT_READ_MS, buffer, size) == GSMResponseOK) && (strlen(buffer) > 0) && (atoll(buffer) > 0);
 }
 
+bool Sodaq_R4X::readModemIdentity()
+{
+    ModemIdentity identity;
+    memset(&identity, 0, sizeof(identity));
+
+    // a single round trip: the basic command first, the extended ones after it
+    println("ATI9;+CCID;+CIMI;+CGSN;+CGMR;+COPS=3,0;+COPS?");
+
+    char buffer[192];
+
+    if ((readResponse(buffer, sizeof(buffer)) == GSMResponseOK) && parseModemIdentity(buffer, &identity)) {
+        identity.valid = true;
+    }
+    else {
+        // the modem refused the line, one command at a time (the SIM ones may fail)
+        _identity.valid = false;
+
+        identity.valid = getIMEI(identity.imei, sizeof(identity.imei)) &&
+                         getFirmwareVersion(identity.firmwareVersion, sizeof(identity.firmwareVersion)) &&
+                         getFirmwareRevision(identity.firmwareRevision, sizeof(identity.firmwareRevision));
+
+        if (identity.valid) {
+            getIMSI(identity.imsi, sizeof(identity.imsi));
+            getCCID(identity.ccid, sizeof(identity.ccid));
+            getOperatorInfoString(identity.operatorName, sizeof(identity.operatorName));
+        }
+    }
+
+    if (!identity.valid) {
+        return false;
+    }
+
+    _identity = identity;
+
+    return true;
+}
+
+const ModemIdentity* Sodaq_R4X::getModemIdentity(bool refresh)
+{
+    if ((refresh || !_identity.valid) && !readModemIdentity()) {
+        return NULL;
+    }
+
+    return &_identity;
+}
+
+bool Sodaq_R4X::refreshOperator()
+{
+    if (!_identity.valid) {
+        return readModemIdentity();
+    }
+
+    return getOperatorInfoString(_identity.operatorName, sizeof(_identity.operatorName));
+}
+
+// Splits the response lines of readModemIdentity(): the prefixed ones are recognized by their prefix,
+// the others follow the order of the commands (ATI9, AT+CIMI, AT+CGSN, AT+CGMR).
+bool Sodaq_R4X::parseModemIdentity(char* response, ModemIdentity* identity)
+{
+    struct {
+        char*  field;
+        size_t size;
+    } plainLines[] = {
+        { identity->firmwareRevision, sizeof(identity->firmwareRevision) },
+        { identity->imsi,             sizeof(identity->imsi) },
+        { identity->imei,             sizeof(identity->imei) },
+        { identity->firmwareVersion,  sizeof(identity->firmwareVersion) },
+    };
+
+    size_t plainCount = 0;
+    char* line = response;
+
+    while (line && *line) {
+        char* next = strchr(line, LF);
+
+        if (next) {
+            *next++ = '\0';
+        }
+
+        if (startsWith("+CCID: ", line)) {
+            strncpy(identity->ccid, line + 7, sizeof(identity->ccid) - 1);
+        }
+        else if (startsWith("+COPS: ", line)) {
+            sscanf(line + 7, "%*d,%*d,\"%32[^\"]\"", identity->operatorName);
+        }
+        else if (plainCount < sizeof(plainLines) / sizeof(plainLines[0])) {
+            strncpy(plainLines[plainCount].field, line, plainLines[plainCount].size - 1);
+            plainCount++;
+        }
+        else {
+            return false;
+        }
+
+        line = next;
+    }
+
+    return (plainCount == sizeof(plainLines) / sizeof(plainLines[0])) && (identity->ccid[0] != '\0') &&
+           (atoll(identity->imsi) > 0) && (atoll(identity->imei) > 0);
+}
+
+// Copies a cached identity field, returns false if there is nothing cached.
+bool Sodaq_R4X::copyIdentityField(bool valid, const char* field, char* buffer, size_t size)
+{
+    if (!valid || (field[0] == '\0')) {
+        return false;
+    }
+
+    strncpy(buffer, field, size - 1);
+    buffer[size - 1] = '\0';
+
+    return true;
+}
+
 SimStatuses Sodaq_R4X::getSimStatus()
 {
     println("AT+CPIN?");
@@ -540,13 +1253,17 @@ bool Sodaq_R4X::execCommand(const char* command, uint32_t timeout, char* buffer,
 {
     println(command);
 
-    return (readResponse(buffer, size, NULL, timeout) == GSMResponseOK);
+    _execCommand = command;
+    bool result  = (readResponse(buffer, size, NULL, timeout) == GSMResponseOK);
+    _execCommand = NULL;
+
+    return result;
 }
 
 // Returns true if the modem replies to "AT" commands without timing out.
 bool Sodaq_R4X::isAlive()
 {
-    return execCommand(STR_AT, 450);
+    return execCommand(STR_AT, ISALIVE_TIMEOUT);
 }
 
 // Returns true if the modem is attached to the network and has an activated data connection.
@@ -601,6 +1318,208 @@ void Sodaq_R4X::purgeAllResponsesRead()
     while ((readResponse(NULL, 0, NULL, 1000) != GSMResponseTimeout) && !is_timedout(start, 2000)) {}
 }
 
+// Drains the modem stream without blocking and handles all complete lines as URCs.
+// Also sends the next queued command and completes the one in progress.
+// Incomplete lines are left in the receive ring for the next call.
+bool Sodaq_R4X::poll()
+{
+    bool handled = false;
+
+    if ((_commandCount > 0) && !_commandStarted) {
+        _sendingCommand = true;
+        println(_commandQueue[0].command);
+        _sendingCommand = false;
+
+        _commandStarted      = true;
+        _commandStartMillis  = millis();
+        _commandResponseSize = 0;
+        _commandResponse[0]  = '\0';
+        handled = true;
+    }
+
+    fillRxRing();
+
+    while (hasRxLine()) {
+        if (readLn(_inputBuffer, _inputBufferSize, 0) == 0) {
+            continue;
+        }
+
+        debugPrint("<< ");
+        debugPrintln(_inputBuffer);
+
+        if (!_commandStarted || !handleCommandLine(_inputBuffer)) {
+            checkURC(_inputBuffer);
+        }
+
+        handled = true;
+        fillRxRing();
+    }
+
+    if (_commandStarted && is_timedout(_commandStartMillis, _commandQueue[0].timeout)) {
+        completeCommand(GSMResponseTimeout);
+        handled = true;
+    }
+
+    callCompletedCommand();
+
+    return handled;
+}
+
+uint8_t Sodaq_R4X::submitCommand(const char* command, uint32_t timeout, CommandCallbackPtr callback,
+    void* context, const char* prefix)
+{
+    return queueCommand(command, timeout, callback, context, prefix, -1);
+}
+
+bool Sodaq_R4X::isCommandPending(uint8_t handle) const
+{
+    for (uint8_t i = 0; i < _commandCount; i++) {
+        if (_commandQueue[i].handle == handle) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Sodaq_R4X::finishCommands()
+{
+    while (_commandCount > 0) {
+        sodaq_wdt_reset();
+        poll();
+    }
+}
+
+uint8_t Sodaq_R4X::queueCommand(const char* command, uint32_t timeout, CommandCallbackPtr callback,
+    void* context, const char* prefix, int8_t socketID)
+{
+    if ((_commandCount >= SODAQ_R4X_MAX_QUEUED_COMMANDS) || (strlen(command) >= SODAQ_R4X_MAX_QUEUED_COMMAND_LENGTH)) {
+        return 0;
+    }
+
+    // handles wrap around, 0 is never used
+    if (++_lastCommandHandle == 0) {
+        _lastCommandHandle = 1;
+    }
+
+    QueuedCommand* entry = &_commandQueue[_commandCount++];
+
+    entry->handle   = _lastCommandHandle;
+    entry->prefix   = (prefix != NULL && prefix[0] != 0) ? prefix : NULL;
+    entry->timeout  = timeout;
+    entry->socketID = socketID;
+    entry->callback = callback;
+    entry->context  = context;
+    strcpy(entry->command, command);
+
+    return entry->handle;
+}
+
+// Handles a line read while a queued command is in progress, in the same way readResponse() does.
+// Returns false if the line is not part of the response.
+bool Sodaq_R4X::handleCommandLine(char* line)
+{
+    if (startsWith(STR_AT, line)) {
+        return true; // skip echoed back command
+    }
+
+    if (startsWith(STR_RESPONSE_OK, line)) {
+        completeCommand(GSMResponseOK);
+        return true;
+    }
+
+    if (startsWith(STR_RESPONSE_ERROR, line) ||
+            startsWith(STR_RESPONSE_CME_ERROR, line) ||
+            startsWith(STR_RESPONSE_CMS_ERROR, line)) {
+        completeCommand(GSMResponseError);
+        return true;
+    }
+
+    const char* prefix = _commandQueue[0].prefix;
+    bool hasPrefix = (prefix != NULL) && startsWith(prefix, line);
+
+    if (!hasPrefix) {
+        if (prefix != NULL) {
+            return false;
+        }
+
+        if (checkURC(line)) {
+            return true;
+        }
+    }
+
+    if (hasPrefix) {
+        line += strlen(prefix);
+    }
+
+    if ((_commandResponseSize > 0) && (_commandResponseSize < sizeof(_commandResponse) - 1)) {
+        _commandResponse[_commandResponseSize++] = LF;
+    }
+
+    size_t count = min(strlen(line), sizeof(_commandResponse) - 1 - _commandResponseSize);
+
+    memcpy(&_commandResponse[_commandResponseSize], line, count);
+    _commandResponseSize += count;
+    _commandResponse[_commandResponseSize] = '\0';
+
+    return true;
+}
+
+// Removes the command in progress from the queue, its callback is called by callCompletedCommand().
+void Sodaq_R4X::completeCommand(GSMResponseTypes result)
+{
+    int8_t socketID = _commandQueue[0].socketID;
+
+    _completedHandle   = _commandQueue[0].handle;
+    _completedResult   = result;
+    _completedCallback = _commandQueue[0].callback;
+    _completedContext  = _commandQueue[0].context;
+
+    _commandCount--;
+    memmove(&_commandQueue[0], &_commandQueue[1], _commandCount * sizeof(QueuedCommand));
+    _commandStarted = false;
+
+    if (socketID >= 0) {
+        _socketClosedBit[socketID] = (result != GSMResponseOK);
+    }
+}
+
+// Calls the callback of the command completed last, if any. Cleared first, as the callback may poll() again.
+void Sodaq_R4X::callCompletedCommand()
+{
+    CommandCallbackPtr callback = _completedCallback;
+
+    if (callback) {
+        _completedCallback = NULL;
+        callback(_completedHandle, _completedResult, _commandResponse, _completedContext);
+    }
+}
+
+// Fails all the queued commands, including the one in progress, e.g. before the modem is switched off.
+void Sodaq_R4X::flushCommands()
+{
+    while (_commandCount > 0) {
+        _commandResponseSize = 0;
+        _commandResponse[0]  = '\0';
+
+        completeCommand(GSMResponseError);
+        callCompletedCommand();
+    }
+}
+
+bool Sodaq_R4X::setURCHandler(const char* token, URCHandlerPtr handler)
+{
+    if (token == NULL || handler == NULL || _urcHandlerCount >= SODAQ_R4X_MAX_URC_HANDLERS) {
+        return false;
+    }
+
+    _urcHandlers[_urcHandlerCount].token   = token;
+    _urcHandlers[_urcHandlerCount].handler = handler;
+    _urcHandlerCount++;
+
+    return true;
+}
+
 bool Sodaq_R4X::setApn(const char* apn)
 {
     print("AT+CGDCONT=");
@@ -620,27 +1539,67 @@ bool Sodaq_R4X::setIndicationsActive(bool on)
     return (readResponse() == GSMResponseOK);
 }
 
-void Sodaq_R4X::setPin(const char * pin)
+void Sodaq_R4X::setPin(const char * pin)
+{
+    size_t len = strlen(pin);
+    _pin = static_cast<char*>(realloc(_pin, len + 1));
+    strcpy(_pin, pin);
+}
+
+bool Sodaq_R4X::setRadioActive(bool on)
+{
+    print("AT+CFUN=");
+    println(on ? "1" : "0");
+
+    if (readResponse() != GSMResponseOK) {
+        _config.radioActive = TriBoolUndefined;
+        return false;
+    }
+
+    _config.radioActive = on ? TriBoolTrue : TriBoolFalse;
+
+    return true;
+}
+
+// Sets what +CEREG reports (in the URC and the AT+CEREG? response), unless the modem already has the mode.
+bool Sodaq_R4X::setCeregMode(int8_t mode)
 {
-    size_t len = strlen(pin);
-    _pin = static_cast<char*>(realloc(_pin, len + 1));
-    strcpy(_pin, pin);
-}
+    if (_config.ceregMode == mode) {
+        return true;
+    }
 
-bool Sodaq_R4X::setRadioActive(bool on)
-{
-    print("AT+CFUN=");
-    println(on ? "1" : "0");
+    print("AT+CEREG=");
+    println(mode);
 
-    return (readResponse() == GSMResponseOK);
+    if (readResponse() != GSMResponseOK) {
+        _config.ceregMode = -1;
+        return false;
+    }
+
+    _config.ceregMode = mode;
+
+    return true;
 }
 
 bool Sodaq_R4X::setVerboseErrors(bool on)
 {
+    int8_t mode = on ? 2 : 0;
+
+    if (_config.verboseErrors == mode) {
+        return true;
+    }
+
     print("AT+CMEE=");
-    println(on ? '2' : '0');
+    println(mode);
 
-    return (readResponse() == GSMResponseOK);
+    if (readResponse() != GSMResponseOK) {
+        _config.verboseErrors = -1;
+        return false;
+    }
+
+    _config.verboseErrors = mode;
+
+    return true;
 }
 
 
@@ -712,8 +1671,7 @@ bool Sodaq_R4X::socketClose(uint8_t socketID, bool async)
         println();
     }
 
-    _socketClosedBit   [socketID] = true;
-    _socketPendingBytes[socketID] = 0;
+    resetSocket(socketID);
 
     if (readResponse(NULL, 0, NULL, SOCKET_CLOSE_TIMEOUT) != GSMResponseOK) {
         return false;
@@ -738,6 +1696,8 @@ int Sodaq_R4X::socketCloseAll() {
 
 bool Sodaq_R4X::socketConnect(uint8_t socketID, const char* remoteHost, const uint16_t remotePort)
 {
+    uint32_t start = millis();
+
     print("AT+USOCO=");
     print(socketID);
     print(",\"");
@@ -749,9 +1709,25 @@ bool Sodaq_R4X::socketConnect(uint8_t socketID, const char* remoteHost, const ui
 
     _socketClosedBit  [socketID] = !b;
 
+    recordTelemetry(TelemetrySocketConnect, start, b);
+
     return b;
 }
 
+uint8_t Sodaq_R4X::socketConnectAsync(uint8_t socketID, const char* remoteHost, const uint16_t remotePort,
+    CommandCallbackPtr callback, void* context)
+{
+    char command[SODAQ_R4X_MAX_QUEUED_COMMAND_LENGTH];
+
+    int length = snprintf(command, sizeof(command), "AT+USOCO=%u,\"%s\",%u", socketID, remoteHost, remotePort);
+
+    if ((socketID >= SOCKET_COUNT) || (length < 0) || ((size_t)length >= sizeof(command))) {
+        return 0;
+    }
+
+    return queueCommand(command, SOCKET_CONNECT_TIMEOUT, callback, context, NULL, socketID);
+}
+
 int Sodaq_R4X::socketCreate(uint16_t localPort, Protocols protocol)
 {
     print("AT+USOCR=");
@@ -773,12 +1749,14 @@ int Sodaq_R4X::socketCreate(uint16_t localPort, Protocols protocol)
 
     int socketID;
 
-    if ((sscanf(buffer, "%d", &socketID) != 1) || (socketID < 0) || (socketID > SOCKET_COUNT)) {
+    if ((sscanf(buffer, "%d", &socketID) != 1) || (socketID < 0) || (socketID >= SOCKET_COUNT)) {
         return SOCKET_FAIL;
     }
 
-    _socketClosedBit   [socketID] = true;
-    _socketPendingBytes[socketID] = 0;
+    resetSocket(socketID);
+
+    _socketIsUDP[socketID] = (protocol == UDP);
+    memset(&_socketStats[socketID], 0, sizeof(_socketStats[socketID]));
 
     return socketID;
 }
@@ -823,7 +1801,7 @@ bool Sodaq_R4X::socketFlush(uint8_t socketID, uint32_t timeout)
 
 size_t Sodaq_R4X::socketGetPendingBytes(uint8_t socketID)
 {
-    return _socketPendingBytes[socketID];
+    return _socketPendingBytes[socketID] + (uint16_t)(_socketRxBuffer[socketID].head - _socketRxBuffer[socketID].tail);
 }
 
 bool Sodaq_R4X::socketHasPendingBytes(uint8_t socketID)
@@ -836,46 +1814,124 @@ bool Sodaq_R4X::socketIsClosed(uint8_t socketID)
     return _socketClosedBit[socketID];
 }
 
+uint8_t Sodaq_R4X::socketSelect(uint8_t mask, uint32_t timeout)
+{
+    uint32_t startTime = millis();
+
+    while (true) {
+        sodaq_wdt_reset();
+        bool handled = poll();
+
+        uint8_t ready = 0;
+
+        for (uint8_t i = 0; i < SOCKET_COUNT; i++) {
+            if ((mask & (1 << i)) && (socketHasPendingBytes(i) || (!_socketIsUDP[i] && _socketClosedBit[i]))) {
+                ready |= (1 << i);
+            }
+        }
+
+        if ((ready != 0) || is_timedout(startTime, timeout)) {
+            if (ready != 0) {
+                fillSocketBuffers(mask);
+            }
+
+            return ready;
+        }
+
+        if (!handled) {
+            idleSleep();
+        }
+    }
+}
+
+const SocketStats& Sodaq_R4X::socketGetStats(uint8_t socketID) const
+{
+    return _socketStats[socketID];
+}
+
+void Sodaq_R4X::resetSocket(uint8_t socketID)
+{
+    _socketClosedBit   [socketID] = true;
+    _socketPendingBytes[socketID] = 0;
+
+    _socketRxBuffer[socketID].head = 0;
+    _socketRxBuffer[socketID].tail = 0;
+}
+
+void Sodaq_R4X::fillSocketBuffers(uint8_t skipMask)
+{
+    // not while the modem is busy with a queued command
+    if (_commandCount > 0) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < SOCKET_COUNT; i++) {
+        SocketReceiveBuffer* rx = &_socketRxBuffer[i];
+        size_t space = SODAQ_R4X_SOCKET_RX_BUFFER_SIZE - (uint16_t)(rx->head - rx->tail);
+
+        // UDP datagrams are left in the modem, they come with their remote address
+        if ((skipMask & (1 << i)) || _socketIsUDP[i] || _socketClosedBit[i] || (_socketPendingBytes[i] == 0) ||
+                (space == 0)) {
+            continue;
+        }
+
+        uint8_t data[SODAQ_R4X_SOCKET_RX_BUFFER_SIZE];
+        size_t  count = socketReadModem(i, data, space);
+
+        for (size_t j = 0; j < count; j++) {
+            rx->data[rx->head++ & (SODAQ_R4X_SOCKET_RX_BUFFER_SIZE - 1)] = data[j];
+        }
+    }
+}
+
 size_t Sodaq_R4X::socketRead(uint8_t socketID, uint8_t* buffer, size_t size)
 {
-    if (!socketHasPendingBytes(socketID)) {
+    SocketReceiveBuffer* rx = &_socketRxBuffer[socketID];
+    size_t count = 0;
+
+    // the data read ahead by the waits comes first
+    while ((count < size) && (rx->tail != rx->head)) {
+        buffer[count++] = rx->data[rx->tail++ & (SODAQ_R4X_SOCKET_RX_BUFFER_SIZE - 1)];
+    }
+
+    if ((count == size) || ((count > 0) && (_socketPendingBytes[socketID] == 0))) {
+        return count;
+    }
+
+    return count + socketReadModem(socketID, buffer + count, size - count);
+}
+
+size_t Sodaq_R4X::socketReadModem(uint8_t socketID, uint8_t* buffer, size_t size)
+{
+    if (_socketPendingBytes[socketID] == 0) {
         // no URC has happened, no socket to read
         debugPrintln("Reading from without available bytes!");
         return 0;
     }
 
-    execCommand("AT+UDCONF=1,1");
-
-    size = min(size, min(SODAQ_R4X_MAX_SOCKET_BUFFER, _socketPendingBytes[socketID]));
+    if (!checkSocketDataMode()) {
+        return 0;
+    }
 
-    char   outBuffer[SODAQ_R4X_MAX_SOCKET_BUFFER];
-    int    retSocketID;
-    size_t retSize;
+    size = min(size, min(_socketBinaryMode ? SODAQ_R4X_MAX_SOCKET_BUFFER : SODAQ_R4X_MAX_SOCKET_BUFFER / 2,
+                         _socketPendingBytes[socketID]));
 
     print("AT+USORD=");
     print(socketID);
     print(',');
     println(size);
 
-    if (readResponse(outBuffer, sizeof(outBuffer), "+USORD: ") != GSMResponseOK) {
-        return 0;
-    }
+    _socketStats[socketID].readCommands++;
 
-    if (sscanf(outBuffer, "%d,%d,\"%[^\"]\"", &retSocketID, &retSize, outBuffer) != 3) {
-        return 0;
-    }
+    int    retSocketID;
+    size_t retSize = readSocketData("+USORD: ", false, buffer, size, &retSocketID);
 
-    if ((retSocketID < 0) || (retSocketID >= SOCKET_COUNT)) {
+    if (retSize == 0) {
         return 0;
     }
 
-    _socketPendingBytes[socketID] -= retSize;
-
-    if (buffer != NULL && size > 0) {
-        for (size_t i = 0; i < retSize * 2; i += 2) {
-            buffer[i / 2] = HEX_PAIR_TO_BYTE(outBuffer[i], outBuffer[i + 1]);
-        }
-    }
+    _socketPendingBytes[retSocketID] -= min(retSize, _socketPendingBytes[retSocketID]);
+    _socketStats[retSocketID].bytesReceived += retSize;
 
     return retSize;
 }
@@ -888,38 +1944,29 @@ size_t Sodaq_R4X::socketReceive(uint8_t socketID, uint8_t* buffer, size_t size)
         return 0;
     }
 
-    execCommand("AT+UDCONF=1,1");
-
-    size = min(size, min(SODAQ_R4X_MAX_SOCKET_BUFFER, _socketPendingBytes[socketID]));
+    if (!checkSocketDataMode()) {
+        return 0;
+    }
 
-    char   outBuffer[SODAQ_R4X_MAX_SOCKET_BUFFER];
-    int    retSocketID;
-    size_t retSize;
+    size = min(size, min(_socketBinaryMode ? SODAQ_R4X_MAX_SOCKET_BUFFER : SODAQ_R4X_MAX_SOCKET_BUFFER / 2,
+                         _socketPendingBytes[socketID]));
 
     print("AT+USORF=");
     print(socketID);
     print(',');
     println(size);
 
-    if (readResponse(outBuffer, sizeof(outBuffer), "+USORF: ") != GSMResponseOK) {
-        return 0;
-    }
+    _socketStats[socketID].readCommands++;
 
-    if (sscanf(outBuffer, "%d,\"%*[^\"]\",%*d,%d,\"%[^\"]\"", &retSocketID, &retSize, outBuffer) != 3) {
-        return 0;
-    }
+    int    retSocketID;
+    size_t retSize = readSocketData("+USORF: ", true, buffer, size, &retSocketID);
 
-    if ((retSocketID < 0) || (retSocketID >= SOCKET_COUNT)) {
+    if (retSize == 0) {
         return 0;
     }
 
-    _socketPendingBytes[socketID] -= retSize;
-
-    if (buffer != NULL && size > 0) {
-        for (size_t i = 0; i < retSize * 2; i += 2) {
-            buffer[i / 2] = HEX_PAIR_TO_BYTE(outBuffer[i], outBuffer[i + 1]);
-        }
-    }
+    _socketPendingBytes[retSocketID] -= min(retSize, _socketPendingBytes[retSocketID]);
+    _socketStats[retSocketID].bytesReceived += retSize;
 
     return retSize;
 }
@@ -932,7 +1979,9 @@ size_t Sodaq_R4X::socketSend(uint8_t socketID, const char* remoteHost, const uin
         return 0;
     }
 
-    execCommand("AT+UDCONF=1,1");
+    if (!checkSocketDataMode()) {
+        return 0;
+    }
 
     print("AT+USOST=");
     print(socketID);
@@ -941,15 +1990,31 @@ size_t Sodaq_R4X::socketSend(uint8_t socketID, const char* remoteHost, const uin
     print("\",");
     print(remotePort);
     print(',');
-    print(size);
-    print(",\"");
 
-    for (size_t i = 0; i < size; ++i) {
-        print(static_cast<char>(NIBBLE_TO_HEX_CHAR(HIGH_NIBBLE(buffer[i]))));
-        print(static_cast<char>(NIBBLE_TO_HEX_CHAR(LOW_NIBBLE(buffer[i]))));
+    _socketStats[socketID].writeCommands++;
+
+    if (_socketBinaryMode) {
+        println(size);
+
+        if (readResponse() != GSMResponsePrompt) {
+            return 0;
+        }
+
+        // After the @ prompt reception, wait for a minimum of 50 ms before sending data.
+        delay(51);
+
+        _modemStream->write(buffer, size);
+
+        debugPrintf("[%u bytes]", (unsigned)size);
     }
+    else {
+        print(size);
+        print(",\"");
 
-    println('"');
+        writeHex(buffer, size);
+
+        println('"');
+    }
 
     char outBuffer[64];
 
@@ -964,6 +2029,8 @@ size_t Sodaq_R4X::socketSend(uint8_t socketID, const char* remoteHost, const uin
         return 0;
     }
 
+    _socketStats[socketID].bytesSent += sentLength;
+
     return sentLength;
 }
 
@@ -997,9 +2064,24 @@ bool Sodaq_R4X::socketSetR4Option(uint8_t socketID, uint16_t level, uint16_t opt
 bool Sodaq_R4X::socketWaitForClose(uint8_t socketID, uint32_t timeout)
 {
     uint32_t startTime = millis();
+    uint32_t lastCheck = startTime;
 
-    while (isAlive() && !socketIsClosed(socketID) && !is_timedout(startTime, timeout)) {
-        sodaq_wdt_safe_delay(10);
+    // +UUSOCL closes the socket, only check now and then that the modem is still there
+    while (!socketIsClosed(socketID) && !is_timedout(startTime, timeout)) {
+        sodaq_wdt_reset();
+
+        if (!poll()) {
+            if (is_timedout(lastCheck, 1000)) {
+                if (!isAlive()) {
+                    break;
+                }
+
+                lastCheck = millis();
+            }
+            else {
+                idleSleep();
+            }
+        }
     }
 
     return socketIsClosed(socketID);
@@ -1007,73 +2089,100 @@ bool Sodaq_R4X::socketWaitForClose(uint8_t socketID, uint32_t timeout)
 
 bool Sodaq_R4X::socketWaitForRead(uint8_t socketID, uint32_t timeout)
 {
-    if (socketHasPendingBytes(socketID)) {
-        return true;
-    }
+    return socketWaitForData(socketID, false, timeout);
+}
 
-    uint32_t startTime = millis();
+bool Sodaq_R4X::socketWaitForReceive(uint8_t socketID, uint32_t timeout)
+{
+    return socketWaitForData(socketID, true, timeout);
+}
 
-    while (!socketHasPendingBytes(socketID) && !socketIsClosed(socketID) && !is_timedout(startTime, timeout)) {
-        print("AT+USORD=");
-        print(socketID);
-        println(",0");
+void Sodaq_R4X::socketQueryPendingBytes(uint8_t socketID, bool udp)
+{
+    print(udp ? "AT+USORF=" : "AT+USORD=");
+    print(socketID);
+    println(",0");
 
-        char buffer[128];
+    char buffer[128];
 
-        if (readResponse(buffer, sizeof(buffer), "+USORD: ") == GSMResponseOK) {
-            int retSocketID;
-            int receiveSize;
+    if (readResponse(buffer, sizeof(buffer), udp ? "+USORF: " : "+USORD: ") == GSMResponseOK) {
+        int retSocketID;
+        int receiveSize;
 
-            if (sscanf(buffer, "%d,%d", &retSocketID, &receiveSize) == 2) {
-                _socketPendingBytes[retSocketID] = receiveSize;
-            }
+        if ((sscanf(buffer, "%d,%d", &retSocketID, &receiveSize) == 2) &&
+                (retSocketID >= 0) && (retSocketID < SOCKET_COUNT)) {
+            _socketPendingBytes[retSocketID] = receiveSize;
         }
-
-        sodaq_wdt_safe_delay(10);
     }
-
-    return socketHasPendingBytes(socketID);
 }
 
-bool Sodaq_R4X::socketWaitForReceive(uint8_t socketID, uint32_t timeout)
+bool Sodaq_R4X::socketWaitForData(uint8_t socketID, bool udp, uint32_t timeout)
 {
     if (socketHasPendingBytes(socketID)) {
         return true;
     }
 
     uint32_t startTime = millis();
+    uint32_t lastQuery = startTime;
 
-    while (!socketHasPendingBytes(socketID) && !is_timedout(startTime, timeout)) {
-        print("AT+USORF=");
-        print(socketID);
-        println(",0");
-
-        char buffer[128];
-
-        if (readResponse(buffer, sizeof(buffer), "+USORF: ") == GSMResponseOK) {
-            int retSocketID;
-            int receiveSize;
+    while (!socketHasPendingBytes(socketID) && (udp || !socketIsClosed(socketID)) && !is_timedout(startTime, timeout)) {
+        sodaq_wdt_reset();
 
-            if (sscanf(buffer, "%d,%d", &retSocketID, &receiveSize) == 2) {
-                _socketPendingBytes[retSocketID] = receiveSize;
-            }
+        // the modem announces new data with +UUSORD/+UUSORF, poll() picks those up
+        if (poll()) {
+            lastQuery = millis();
+        }
+        else if ((SODAQ_R4X_SOCKET_POLL_INTERVAL > 0) && is_timedout(lastQuery, SODAQ_R4X_SOCKET_POLL_INTERVAL)) {
+            socketQueryPendingBytes(socketID, udp);
+            lastQuery = millis();
+        }
+        else {
+            idleSleep();
         }
+    }
 
-        sodaq_wdt_safe_delay(250);
+    if (!socketHasPendingBytes(socketID)) {
+        return false;
     }
 
-    return socketHasPendingBytes(socketID);
+    // this is an explicit wait, so the other sockets can be read ahead here (unlike in poll())
+    fillSocketBuffers(1 << socketID);
+
+    return true;
 }
 
 size_t Sodaq_R4X::socketWrite(uint8_t socketID, const uint8_t* buffer, size_t size)
 {
-    execCommand("AT+UDCONF=1,1");
+    SocketIoVec iov = { buffer, size };
+
+    return socketWritev(socketID, &iov, 1);
+}
+
+size_t Sodaq_R4X::socketWritev(uint8_t socketID, const SocketIoVec* iov, size_t count)
+{
+    if (!checkSocketDataMode()) {
+        return 0;
+    }
+
+    size_t size = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size += iov[i].size;
+    }
+
+    size = min(size, _socketBinaryMode ? SODAQ_R4X_MAX_SOCKET_BUFFER : SODAQ_R4X_MAX_SOCKET_HEX_WRITE);
+
+    if (size == 0) {
+        return 0;
+    }
 
     print("AT+USOWR=");
     print(socketID);
     print(",");
     println(size);
 
+    _socketStats[socketID].writeCommands++;
+
     if (readResponse() != GSMResponsePrompt) {
         return 0;
     }
@@ -1081,12 +2190,28 @@ size_t Sodaq_R4X::socketWrite(uint8_t socketID, const uint8_t* buffer, size_t si
     // After the @ prompt reception, wait for a minimum of 50 ms before sending data.
     delay(51);
 
-    for (size_t i = 0; i < size; i++) {
-        print(static_cast<char>(NIBBLE_TO_HEX_CHAR(HIGH_NIBBLE(buffer[i]))));
-        print(static_cast<char>(NIBBLE_TO_HEX_CHAR(LOW_NIBBLE(buffer[i]))));
+    // Each part goes straight to the modem, up to "size" bytes in total
+    size_t remaining = size;
+
+    for (size_t i = 0; (i < count) && (remaining > 0); i++) {
+        size_t partSize = min(iov[i].size, remaining);
+
+        if (_socketBinaryMode) {
+            _modemStream->write(iov[i].data, partSize);
+        }
+        else {
+            writeHex(iov[i].data, partSize);
+        }
+
+        remaining -= partSize;
     }
 
-    debugPrintln();
+    if (_socketBinaryMode) {
+        debugPrintf("[%u bytes]", (unsigned)size);
+    }
+    else {
+        debugPrintln();
+    }
 
     char outBuffer[64];
 
@@ -1101,6 +2226,8 @@ size_t Sodaq_R4X::socketWrite(uint8_t socketID, const uint8_t* buffer, size_t si
         return 0;
     }
 
+    _socketStats[socketID].bytesSent += sentLength;
+
     return sentLength;
 }
 
@@ -1130,6 +2257,7 @@ bool Sodaq_R4X::mqttLogin(uint32_t timeout)
     uint32_t startTime = millis();
 
     if ((readResponse(buffer, sizeof(buffer), "+UMQTTC: ", timeout) != GSMResponseOK) || !startsWith("1,1", buffer)) {
+        recordTelemetry(TelemetryMqttConnect, startTime, false);
         return false;
     }
 
@@ -1138,6 +2266,8 @@ bool Sodaq_R4X::mqttLogin(uint32_t timeout)
         mqttLoop();
     }
 
+    recordTelemetry(TelemetryMqttConnect, startTime, _mqttLoginResult == 0);
+
     return (_mqttLoginResult == 0);
 }
 
@@ -1154,21 +2284,7 @@ bool Sodaq_R4X::mqttLogout()
 void Sodaq_R4X::mqttLoop()
 {
     sodaq_wdt_reset();
-    if (!_modemStream->available()) {
-        return;
-    }
-
-    int count = readLn(_inputBuffer, _inputBufferSize, 250); // 250ms, how many bytes at which baudrate?
-    sodaq_wdt_reset();
-
-    if (count <= 0) {
-        return;
-    }
-
-    debugPrint("<< ");
-    debugPrintln(_inputBuffer);
-
-    checkURC(_inputBuffer);
+    poll();
 }
 
 bool Sodaq_R4X::mqttPing(const char* server)
@@ -1184,7 +2300,8 @@ bool Sodaq_R4X::mqttPing(const char* server)
 
 bool Sodaq_R4X::mqttPublish(const char* topic, const uint8_t* msg, size_t size, uint8_t qos, uint8_t retain, bool useHEX)
 {
-    char buffer[16];
+    char     buffer[16];
+    uint32_t start = millis();
 
     print("AT+UMQTTC=2,");
     print(qos);
@@ -1197,19 +2314,23 @@ bool Sodaq_R4X::mqttPublish(const char* topic, const uint8_t* msg, size_t size,
     print(topic);
     print("\",\"");
 
-    for (size_t i = 0; i < size; ++i) {
-        if (useHEX) {
-            print(static_cast<char>(NIBBLE_TO_HEX_CHAR(HIGH_NIBBLE(msg[i]))));
-            print(static_cast<char>(NIBBLE_TO_HEX_CHAR(LOW_NIBBLE(msg[i]))));
-        }
-        else {
+    if (useHEX) {
+        writeHex(msg, size);
+    }
+    else {
+        for (size_t i = 0; i < size; ++i) {
             print((char)msg[i]);
         }
     }
 
     println('"');
 
-    return (readResponse(buffer, sizeof(buffer), "+UMQTTC: ", UMQTT_TIMEOUT) == GSMResponseOK) && startsWith("2,1", buffer);
+    bool success = (readResponse(buffer, sizeof(buffer), "+UMQTTC: ", UMQTT_TIMEOUT) == GSMResponseOK) &&
+                   startsWith("2,1", buffer);
+
+    recordTelemetry(TelemetryMqttPublish, start, success);
+
+    return success;
 }
 
 // returns number of read messages
@@ -1482,8 +2603,7 @@ uint32_t Sodaq_R4X::httpGet(const char* server, uint16_t port, const char* endpo
     // Find out the header size
     _httpGetHeaderSize = httpGetHeaderSize(HTTP_RECEIVE_FILENAME);
 
-    debugPrint("[httpGet] header size: ");
-    debugPrintln(_httpGetHeaderSize);
+    debugPrintf("[httpGet] header size: %u", (unsigned)_httpGetHeaderSize);
 
     if (_httpGetHeaderSize == 0) {
         return 0;
@@ -1526,7 +2646,7 @@ uint32_t Sodaq_R4X::httpGetHeaderSize(const char* filename)
         }
 
         size_t ix;
-        for (ix = 0; state != 4 && ix < sizeof(buffer); ix++) {
+        for (ix = 0; state != 4 && ix < size; ix++) {
             if ((state == 0 || state == 2) && buffer[ix] == '\r') {
                 state++;
             }
@@ -1554,12 +2674,74 @@ size_t Sodaq_R4X::httpGetPartial(uint8_t* buffer, size_t size, uint32_t offset)
         _httpGetHeaderSize = httpGetHeaderSize(HTTP_RECEIVE_FILENAME);
     }
 
-    if (_httpGetHeaderSize == 0) {
-        // Don't trust a file without HTTP response header
-        return 0;
+    if (_httpGetHeaderSize == 0) {
+        // Don't trust a file without HTTP response header
+        return 0;
+    }
+
+    return readFilePartial(HTTP_RECEIVE_FILENAME, buffer, size, _httpGetHeaderSize + offset);
+}
+
+uint32_t Sodaq_R4X::httpReadBody(HttpBodyHandlerPtr handler, void* context, uint32_t offset)
+{
+    if (!handler) {
+        return 0;
+    }
+
+    // the header size is always looked up again, the response file may be newer than _httpGetHeaderSize
+    _httpGetHeaderSize = httpGetHeaderSize(HTTP_RECEIVE_FILENAME);
+
+    uint32_t fileSize;
+
+    if ((_httpGetHeaderSize == 0) || !getFileSize(HTTP_RECEIVE_FILENAME, fileSize)) {
+        return 0;
+    }
+
+    uint32_t bodySize = fileSize - _httpGetHeaderSize;
+    uint32_t delivered = 0;
+    uint8_t window[SODAQ_R4X_HTTP_WINDOW_SIZE];
+
+    while (offset < bodySize) {
+        size_t size = min((uint32_t)sizeof(window), bodySize - offset);
+
+        size = readFilePartial(HTTP_RECEIVE_FILENAME, window, size, _httpGetHeaderSize + offset);
+
+        if (size == 0) {
+            break;
+        }
+
+        if (!handler(window, size, offset, bodySize, context)) {
+            break;
+        }
+
+        offset += size;
+        delivered += size;
+    }
+
+    return delivered;
+}
+
+bool Sodaq_R4X::httpRequestStream(const char* server, uint16_t port, const char* endpoint,
+                                  HttpRequestTypes requestType, HttpBodyHandlerPtr handler, void* context,
+                                  uint32_t* delivered, const char* sendBuffer, size_t sendSize, uint32_t timeout, bool useURC)
+{
+    if (delivered) {
+        *delivered = 0;
+    }
+
+    // without a response buffer only the response file is left in the modem file system,
+    // its size (with the header) is returned, 0 only if the request failed
+    if (httpRequest(server, port, endpoint, requestType, NULL, 0, sendBuffer, sendSize, timeout, useURC) == 0) {
+        return false;
     }
 
-    return readFilePartial(HTTP_RECEIVE_FILENAME, buffer, size, _httpGetHeaderSize + offset);
+    uint32_t size = httpReadBody(handler, context);
+
+    if (delivered) {
+        *delivered = size;
+    }
+
+    return true;
 }
 
 // Creates an HTTP POST request and optionally returns the received data.
@@ -1572,7 +2754,7 @@ uint32_t Sodaq_R4X::httpPost(const char* server, uint16_t port, const char* endp
     deleteFile(HTTP_SEND_TMP_FILENAME); // cleanup the file first (if exists)
 
     if (!writeFile(HTTP_SEND_TMP_FILENAME, (uint8_t*)sendBuffer, sendSize)) {
-        debugPrintln(DEBUG_STR_ERROR "Could not create the http tmp file!");
+        errorPrintf(DEBUG_STR_ERROR "Could not create the http tmp file!");
         return 0;
     }
 
@@ -1597,8 +2779,7 @@ uint32_t Sodaq_R4X::httpPostFromFile(const char* server, uint16_t port, const ch
     // Find out the header size
     _httpGetHeaderSize = httpGetHeaderSize(HTTP_RECEIVE_FILENAME);
 
-    debugPrint("[httpPost] header size: ");
-    debugPrintln(_httpGetHeaderSize);
+    debugPrintf("[httpPost] header size: %u", (unsigned)_httpGetHeaderSize);
 
     if (_httpGetHeaderSize == 0) {
         return 0;
@@ -1623,14 +2804,14 @@ size_t Sodaq_R4X::httpRequest(const char* server, uint16_t port, const char* end
     // that way there is a chance to abort sending the http req command in case of an fs error
     if (requestType == PUT || requestType == POST) {
         if (!sendBuffer || sendSize == 0) {
-            debugPrintln(DEBUG_STR_ERROR "There is no sendBuffer or sendSize set!");
+            errorPrintf(DEBUG_STR_ERROR "There is no sendBuffer or sendSize set!");
             return 0;
         }
 
         deleteFile(HTTP_SEND_TMP_FILENAME); // cleanup the file first (if exists)
 
         if (!writeFile(HTTP_SEND_TMP_FILENAME, (uint8_t*)sendBuffer, sendSize)) {
-            debugPrintln(DEBUG_STR_ERROR "Could not create the http tmp file!");
+            errorPrintf(DEBUG_STR_ERROR "Could not create the http tmp file!");
             return 0;
         }
 
@@ -1647,7 +2828,7 @@ size_t Sodaq_R4X::httpRequest(const char* server, uint16_t port, const char* end
     deleteFile(HTTP_RECEIVE_FILENAME); // cleanup the file first (if exists)
 
     if (requestType >= HttpRequestTypesMAX) {
-        debugPrintln(DEBUG_STR_ERROR "Unknown request type!");
+        errorPrintf(DEBUG_STR_ERROR "Unknown request type!");
         return 0;
     }
 
@@ -1684,12 +2865,13 @@ size_t Sodaq_R4X::httpRequest(const char* server, uint16_t port, const char* end
     }
 
     // check for success while checking URCs
-    // This loop relies on readResponse being called via isAlive()
+    // The +UUHTTPCR URC is handled by poll(), which backoffWait() also calls while waiting,
+    // and it stops waiting as soon as the URC sets the result
     uint32_t start = millis();
-    uint32_t delay_count = 50;
+    Backoff backoff = { HTTP_BACKOFF_MIN, HTTP_BACKOFF_MAX };
     while ((_httpRequestSuccessBit[requestType] == TriBoolUndefined) && !is_timedout(start, timeout)) {
         if (useURC) {
-            isAlive();
+            poll();
             if (_httpRequestSuccessBit[requestType] != TriBoolUndefined) {
                 break;
             }
@@ -1703,17 +2885,13 @@ size_t Sodaq_R4X::httpRequest(const char* server, uint16_t port, const char* end
             }
         }
 
-        sodaq_wdt_safe_delay(delay_count);
-        // Next time wait a little longer, but not longer than 5 seconds
-        if (delay_count < 5000) {
-            delay_count += 250;
-        }
+        backoffWait(&backoff, useURC ? &_httpRequestSuccessBit[requestType] : NULL);
     }
 
     if (_httpRequestSuccessBit[requestType] == TriBoolTrue) {
         uint32_t file_size;
         if (!getFileSize(HTTP_RECEIVE_FILENAME, file_size)) {
-            debugPrintln(DEBUG_STR_ERROR "Could not determine file size");
+            errorPrintf(DEBUG_STR_ERROR "Could not determine file size");
             return 0;
         }
         if (responseBuffer && responseSize > 0 && file_size < responseSize) {
@@ -1725,17 +2903,69 @@ size_t Sodaq_R4X::httpRequest(const char* server, uint16_t port, const char* end
         }
     }
     else if (_httpRequestSuccessBit[requestType] == TriBoolFalse) {
-        debugPrintln(DEBUG_STR_ERROR "An error occurred with the http request!");
+        errorPrintf(DEBUG_STR_ERROR "An error occurred with the http request!");
         return 0;
     }
     else {
-        debugPrintln(DEBUG_STR_ERROR "Timed out waiting for a response for the http request!");
+        errorPrintf(DEBUG_STR_ERROR "Timed out waiting for a response for the http request!");
         return 0;
     }
 
     return 0;
 }
 
+size_t Sodaq_R4X::httpRequestFromProducer(const char* server, uint16_t port, const char* endpoint,
+                                          HttpRequestTypes requestType, HttpBodyProducerPtr producer, void* context,
+                                          char* responseBuffer, size_t responseSize, uint32_t timeout, bool useURC)
+{
+    if (!producer || (requestType != PUT && requestType != POST)) {
+        return 0;
+    }
+
+    deleteFile(HTTP_SEND_TMP_FILENAME); // cleanup the file first (if exists)
+
+    // AT+UDWNFILE appends to an existing file
+    uint8_t chunk[SODAQ_R4X_HTTP_UPLOAD_CHUNK_SIZE];
+    size_t total = 0;
+    bool done = false;
+
+    while (!done) {
+        size_t size = 0;
+
+        // the producer may return less than asked, fill the whole chunk to save round trips
+        while (size < sizeof(chunk)) {
+            size_t count = producer(&chunk[size], sizeof(chunk) - size, context);
+
+            if (count == 0) {
+                done = true;
+                break;
+            }
+
+            size += min(count, sizeof(chunk) - size);
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        if (!writeFile(HTTP_SEND_TMP_FILENAME, chunk, size)) {
+            errorPrintf(DEBUG_STR_ERROR "Could not create the http tmp file!");
+            return 0;
+        }
+
+        total += size;
+    }
+
+    // the request would reference a file that was never written
+    if (total == 0) {
+        errorPrintf(DEBUG_STR_ERROR "The producer returned no body!");
+        return 0;
+    }
+
+    return httpRequestFromFile(server, port, endpoint, requestType, responseBuffer, responseSize,
+                               HTTP_SEND_TMP_FILENAME, timeout, useURC);
+}
+
 // Creates an HTTP request using the (optional) given buffer and
 // (optionally) returns the received data.
 // endpoint should include the initial "/".
@@ -1757,7 +2987,7 @@ size_t Sodaq_R4X::httpRequestFromFile(const char* server, uint16_t port, const c
     deleteFile(HTTP_RECEIVE_FILENAME); // cleanup the file first (if exists)
 
     if (requestType >= HttpRequestTypesMAX) {
-        debugPrintln(DEBUG_STR_ERROR "Unknown request type!");
+        errorPrintf(DEBUG_STR_ERROR "Unknown request type!");
         return 0;
     }
 
@@ -1796,12 +3026,13 @@ size_t Sodaq_R4X::httpRequestFromFile(const char* server, uint16_t port, const c
     }
 
     // check for success while checking URCs
-    // This loop relies on readResponse being called via isAlive()
+    // The +UUHTTPCR URC is handled by poll(), which backoffWait() also calls while waiting,
+    // and it stops waiting as soon as the URC sets the result
     uint32_t start = millis();
-    uint32_t delay_count = 50;
+    Backoff backoff = { HTTP_BACKOFF_MIN, HTTP_BACKOFF_MAX };
     while ((_httpRequestSuccessBit[requestType] == TriBoolUndefined) && !is_timedout(start, timeout)) {
         if (useURC) {
-            isAlive();
+            poll();
             if (_httpRequestSuccessBit[requestType] != TriBoolUndefined) {
                 break;
             }
@@ -1815,17 +3046,13 @@ size_t Sodaq_R4X::httpRequestFromFile(const char* server, uint16_t port, const c
             }
         }
 
-        sodaq_wdt_safe_delay(delay_count);
-        // Next time wait a little longer, but not longer than 5 seconds
-        if (delay_count < 5000) {
-            delay_count += 250;
-        }
+        backoffWait(&backoff, useURC ? &_httpRequestSuccessBit[requestType] : NULL);
     }
 
     if (_httpRequestSuccessBit[requestType] == TriBoolTrue) {
         uint32_t file_size;
         if (!getFileSize(HTTP_RECEIVE_FILENAME, file_size)) {
-            debugPrintln(DEBUG_STR_ERROR "Could not determine file size");
+            errorPrintf(DEBUG_STR_ERROR "Could not determine file size");
             return 0;
         }
         if (responseBuffer && responseSize > 0 && file_size < responseSize) {
@@ -1837,11 +3064,11 @@ size_t Sodaq_R4X::httpRequestFromFile(const char* server, uint16_t port, const c
         }
     }
     else if (_httpRequestSuccessBit[requestType] == TriBoolFalse) {
-        debugPrintln(DEBUG_STR_ERROR "An error occurred with the http request!");
+        errorPrintf(DEBUG_STR_ERROR "An error occurred with the http request!");
         return 0;
     }
     else {
-        debugPrintln(DEBUG_STR_ERROR "Timed out waiting for a response for the http request!");
+        errorPrintf(DEBUG_STR_ERROR "Timed out waiting for a response for the http request!");
         return 0;
     }
 
@@ -1917,12 +3144,12 @@ size_t Sodaq_R4X::readFile(const char* filename, uint8_t* buffer, size_t size)
     // first, make sure the buffer is sufficient
     uint32_t filesize = 0;
     if (!getFileSize(filename, filesize)) {
-        debugPrintln(DEBUG_STR_ERROR "Could not determine file size");
+        errorPrintf(DEBUG_STR_ERROR "Could not determine file size");
         return 0;
     }
 
     if (filesize > size) {
-        debugPrintln(DEBUG_STR_ERROR "The buffer is not big enough to store the file");
+        errorPrintf(DEBUG_STR_ERROR "The buffer is not big enough to store the file");
         return 0;
     }
 
@@ -1937,7 +3164,7 @@ size_t Sodaq_R4X::readFile(const char* filename, uint8_t* buffer, size_t size)
     // reply identifier
     size_t len = readBytesUntil(' ', _inputBuffer, _inputBufferSize);
     if (len == 0 || strstr(_inputBuffer, "+URDFILE:") == NULL) {
-        debugPrintln(DEBUG_STR_ERROR "+URDFILE literal is missing!");
+        errorPrintf(DEBUG_STR_ERROR "+URDFILE literal is missing!");
         return 0;
     }
 
@@ -1949,32 +3176,32 @@ size_t Sodaq_R4X::readFile(const char* filename, uint8_t* buffer, size_t size)
     len = readBytesUntil(',', _inputBuffer, _inputBufferSize);
     filesize = 0; // reset the var before reading from reply string
     if (sscanf(_inputBuffer, "%lu", &filesize) != 1) {
-        debugPrintln(DEBUG_STR_ERROR "Could not parse the file size!");
+        errorPrintf(DEBUG_STR_ERROR "Could not parse the file size!");
         return 0;
     }
     if (filesize == 0 || filesize > size) {
-        debugPrintln(DEBUG_STR_ERROR "Size error!");
+        errorPrintf(DEBUG_STR_ERROR "Size error!");
         return 0;
     }
 
     // opening quote character
     checkChar = timedRead();
     if (checkChar != '"') {
-        debugPrintln(DEBUG_STR_ERROR "Missing starting character (quote)!");
+        errorPrintf(DEBUG_STR_ERROR "Missing starting character (quote)!");
         return 0;
     }
 
     // actual file buffer, written directly to the provided result buffer
     len = readBytes(buffer, filesize);
     if (len != filesize) {
-        debugPrintln(DEBUG_STR_ERROR "File size error!");
+        errorPrintf(DEBUG_STR_ERROR "File size error!");
         return 0;
     }
 
     // closing quote character
     checkChar = timedRead();
     if (checkChar != '"') {
-        debugPrintln(DEBUG_STR_ERROR "Missing termination character (quote)!");
+        errorPrintf(DEBUG_STR_ERROR "Missing termination character (quote)!");
         return 0;
     }
 
@@ -2002,7 +3229,7 @@ size_t Sodaq_R4X::readFilePartial(const char* filename, uint8_t* buffer, size_t
     // where 86 is an example of the size
     size_t len = readBytesUntil(' ', _inputBuffer, _inputBufferSize);
     if (len == 0 || strstr(_inputBuffer, "+URDBLOCK:") == NULL) {
-        debugPrintln(DEBUG_STR_ERROR "+URDBLOCK literal is missing!");
+        errorPrintf(DEBUG_STR_ERROR "+URDBLOCK literal is missing!");
         return 0;
     }
 
@@ -2014,32 +3241,32 @@ size_t Sodaq_R4X::readFilePartial(const char* filename, uint8_t* buffer, size_t
     len = readBytesUntil(',', _inputBuffer, _inputBufferSize);
     uint32_t blocksize = 0; // reset the var before reading from reply string
     if (sscanf(_inputBuffer, "%lu", &blocksize) != 1) {
-        debugPrintln(DEBUG_STR_ERROR "Could not parse the block size!");
+        errorPrintf(DEBUG_STR_ERROR "Could not parse the block size!");
         return 0;
     }
     if (blocksize == 0 || blocksize > size) {
-        debugPrintln(DEBUG_STR_ERROR "Size error!");
+        errorPrintf(DEBUG_STR_ERROR "Size error!");
         return 0;
     }
 
     // opening quote character
     char quote = timedRead();
     if (quote != '"') {
-        debugPrintln(DEBUG_STR_ERROR "Missing starting character (quote)!");
+        errorPrintf(DEBUG_STR_ERROR "Missing starting character (quote)!");
         return 0;
     }
 
     // actual file buffer, written directly to the provided result buffer
     len = readBytes(buffer, blocksize);
     if (len != blocksize) {
-        debugPrintln(DEBUG_STR_ERROR "File size error!");
+        errorPrintf(DEBUG_STR_ERROR "File size error!");
         return 0;
     }
 
     // closing quote character
     quote = timedRead();
     if (quote != '"') {
-        debugPrintln(DEBUG_STR_ERROR "Missing termination character (quote)!");
+        errorPrintf(DEBUG_STR_ERROR "Missing termination character (quote)!");
         return 0;
     }
 
@@ -2108,6 +3335,12 @@ bool Sodaq_R4X::checkBandMasks(const char* bandMaskLTE, const char* bandMaskNB)
         return true;
     }
 
+    // if the masks were already confirmed
+    if (((bandMaskLTE == BAND_MASK_UNCHANGED) || (strcmp(_config.bandMaskLTE, bandMaskLTE) == 0)) &&
+            ((bandMaskNB == BAND_MASK_UNCHANGED) || (strcmp(_config.bandMaskNB, bandMaskNB) == 0))) {
+        return true;
+    }
+
     println("AT+UBANDMASK?");
 
     char buffer[128];
@@ -2122,11 +3355,14 @@ bool Sodaq_R4X::checkBandMasks(const char* bandMaskLTE, const char* bandMaskNB)
         return false;
     }
 
-    bool setLTEMask = (strcmp(bm0, bandMaskLTE) != 0) && (bandMaskLTE != BAND_MASK_UNCHANGED);
-    bool setNBMask = (strcmp(bm1, bandMaskNB) != 0) && (bandMaskNB != BAND_MASK_UNCHANGED);
+    bool setLTEMask = (bandMaskLTE != BAND_MASK_UNCHANGED) && (strcmp(bm0, bandMaskLTE) != 0);
+    bool setNBMask = (bandMaskNB != BAND_MASK_UNCHANGED) && (strcmp(bm1, bandMaskNB) != 0);
 
     // masks are both already match those requested
     if (!setLTEMask && !setNBMask) {
+        strncpy(_config.bandMaskLTE, bm0, sizeof(_config.bandMaskLTE) - 1);
+        strncpy(_config.bandMaskNB, bm1, sizeof(_config.bandMaskNB) - 1);
+
         return true;
     }
 
@@ -2148,13 +3384,67 @@ bool Sodaq_R4X::checkBandMasks(const char* bandMaskLTE, const char* bandMaskNB)
         return false;
     }
 
+    strncpy(_config.bandMaskLTE, setLTEMask ? bandMaskLTE : bm0, sizeof(_config.bandMaskLTE) - 1);
+    strncpy(_config.bandMaskNB, setNBMask ? bandMaskNB : bm1, sizeof(_config.bandMaskNB) - 1);
+
     reboot();
 
     return true;
 }
 
+// Returns the registration status reported by AT+CEREG? (see 3GPP TS 27.007), or -1 on failure.
+int8_t Sodaq_R4X::queryRegistrationStatus()
+{
+    println("AT+CEREG?");
+
+    char buffer[96];
+    int  mode;
+    int  status;
+
+    if ((readResponse(buffer, sizeof(buffer), "+CEREG: ") != GSMResponseOK) ||
+            (sscanf(buffer, "%d,%d", &mode, &status) != 2)) {
+        return -1;
+    }
+
+    _registrationStatus = status;
+
+    return status;
+}
+
+// Returns true if the PDP context of _cid is activated.
+bool Sodaq_R4X::isContextActive()
+{
+    println("AT+CGACT?");
+
+    char buffer[64];
+
+    if (readResponse(buffer, sizeof(buffer), "+CGACT: ") != GSMResponseOK) {
+        return false;
+    }
+
+    // one "<cid>,<state>" line per context
+    for (const char* line = buffer; line != NULL; line = strchr(line, LF)) {
+        int cid;
+        int state;
+
+        if (*line == LF) {
+            line++;
+        }
+
+        if ((sscanf(line, "%d,%d", &cid, &state) == 2) && (cid == _cid)) {
+            return state == 1;
+        }
+    }
+
+    return false;
+}
+
 bool Sodaq_R4X::checkCFUN()
 {
+    if (_config.radioActive == TriBoolTrue) {
+        return true;
+    }
+
     println("AT+CFUN?");
 
     char buffer[64];
@@ -2163,10 +3453,37 @@ bool Sodaq_R4X::checkCFUN()
         return false;
     }
 
-    return ((strcmp(buffer, "1") == 0) || setRadioActive(true));
+    if (strcmp(buffer, "1") == 0) {
+        _config.radioActive = TriBoolTrue;
+        return true;
+    }
+
+    return setRadioActive(true);
 }
 
 bool Sodaq_R4X::checkCOPS(const char* requiredOperator, const char* requiredURAT)
+{
+    // automatic selection is not cached, AT+COPS=0 also kicks a stuck modem back into network search
+    if (strcmp(requiredOperator, AUTOMATIC_OPERATOR) == 0) {
+        _config.operatorSelect[0] = '\0';
+        return selectOperator(requiredOperator, requiredURAT);
+    }
+
+    if (strcmp(_config.operatorSelect, requiredOperator) == 0) {
+        return true;
+    }
+
+    if (!selectOperator(requiredOperator, requiredURAT)) {
+        _config.operatorSelect[0] = '\0';
+        return false;
+    }
+
+    strncpy(_config.operatorSelect, requiredOperator, sizeof(_config.operatorSelect) - 1);
+
+    return true;
+}
+
+bool Sodaq_R4X::selectOperator(const char* requiredOperator, const char* requiredURAT)
 {
     // If auto operator and not NB1, always send the command
     if ((strcmp(requiredOperator, AUTOMATIC_OPERATOR) == 0) && (strcmp(requiredURAT, SODAQ_R4X_NBIOT_URAT) != 0)){
@@ -2203,6 +3520,22 @@ bool Sodaq_R4X::checkCOPS(const char* requiredOperator, const char* requiredURAT
 }
 
 bool Sodaq_R4X::checkProfile(uint8_t requiredProfile)
+{
+    if (_config.mnoProfileRequested == requiredProfile) {
+        return true;
+    }
+
+    if (!selectProfile(requiredProfile)) {
+        _config.mnoProfileRequested = -1;
+        return false;
+    }
+
+    _config.mnoProfileRequested = requiredProfile;
+
+    return true;
+}
+
+bool Sodaq_R4X::selectProfile(uint8_t requiredProfile)
 {
     char buffer[64];
     char firmwareBuffer[128];
@@ -2225,6 +3558,7 @@ bool Sodaq_R4X::checkProfile(uint8_t requiredProfile)
     }
 
     println("AT+COPS=2");
+    _config.operatorSelect[0] = '\0';
     if (readResponse() != GSMResponseOK) {
         return false;
     }
@@ -2241,6 +3575,22 @@ bool Sodaq_R4X::checkProfile(uint8_t requiredProfile)
 }
 
 bool Sodaq_R4X::checkUrat(const char* requiredURAT)
+{
+    if (strcmp(_config.urat, requiredURAT) == 0) {
+        return true;
+    }
+
+    if (!selectUrat(requiredURAT)) {
+        _config.urat[0] = '\0';
+        return false;
+    }
+
+    strncpy(_config.urat, requiredURAT, sizeof(_config.urat) - 1);
+
+    return true;
+}
+
+bool Sodaq_R4X::selectUrat(const char* requiredURAT)
 {
     // Only try and skip if single URAT
     if (strlen(requiredURAT) == 1) {
@@ -2258,6 +3608,7 @@ bool Sodaq_R4X::checkUrat(const char* requiredURAT)
     }
 
     println("AT+COPS=2");
+    _config.operatorSelect[0] = '\0';
     if (readResponse() != GSMResponseOK) {
         return false;
     }
@@ -2273,131 +3624,346 @@ bool Sodaq_R4X::checkUrat(const char* requiredURAT)
     return true;
 }
 
+const Sodaq_R4X::URCTableEntry Sodaq_R4X::_urcTable[] = {
+    { "+CEREG",    &Sodaq_R4X::onRegistrationURC  },
+    { "+CFUN",     &Sodaq_R4X::onFunctionalityURC },
+    { "+UFOTAS",   &Sodaq_R4X::onFOTAStatusURC    },
+    { "+UHTTPER",  &Sodaq_R4X::onHTTPErrorURC     },
+    { "+UUHTTPCR", &Sodaq_R4X::onHTTPResultURC    },
+    { "+UUMQTTC",  &Sodaq_R4X::onMQTTCommandURC   },
+    { "+UUMQTTCM", &Sodaq_R4X::onMQTTMessagesURC  },
+    { "+UUPSMR",   &Sodaq_R4X::onPSMStateURC      },
+    { "+UUSOCL",   &Sodaq_R4X::onSocketClosedURC  },
+    { "+UUSORD",   &Sodaq_R4X::onSocketDataURC    },
+    { "+UUSORF",   &Sodaq_R4X::onSocketDataURC    },
+};
+
+// Returns true if the line carries the token of the command execCommand() is waiting for,
+// e.g. "+CEREG: 2,1" for "AT+CEREG?".
+bool Sodaq_R4X::isExecCommandReply(const char* line)
+{
+    if ((_execCommand == NULL) || (line[0] != '+') || !startsWith("AT+", _execCommand)) {
+        return false;
+    }
+
+    const char* command = _execCommand + 2;
+    size_t      i       = 0;
+
+    while ((line[i] != ':') && (line[i] == command[i])) {
+        i++;
+    }
+
+    return (line[i] == ':') && ((command[i] == '\0') || (command[i] == '=') || (command[i] == '?'));
+}
+
+// Dispatches the line to the handler of its token (the text up to the colon).
+// The driver handlers are looked up with a binary search in _urcTable, then the user handlers are called.
+// Returns true if the line was handled as a URC.
 bool Sodaq_R4X::checkURC(char* buffer)
 {
     if (buffer[0] != '+') {
         return false;
     }
 
-    int param1, param2;
-    char param3[1024];
+    const char* colon = strchr(buffer, ':');
 
-    if (sscanf(buffer, "+UFOTAS: %d,%d", &param1, &param2) == 2) {
-        #ifdef DEBUG
-        debugPrint("Unsolicited: FOTA: ");
-        debugPrint(param1);
-        debugPrint(", ");
-        debugPrintln(param2);
-        #endif
+    if (colon == NULL) {
+        return false;
+    }
 
-        return true;
+    size_t      tokenLength = colon - buffer;
+    const char* params      = colon + 1;
+
+    while (*params == ' ') {
+        params++;
     }
 
-    if (sscanf(buffer, "+UHTTPER: 0,%*d,%d", &param1) == 1) {
-        debugPrint("Unsolicited: UHTTPER: ");
-        debugPrintln(param1);
+    bool handled = false;
 
-        _httpRequestSuccessBit[1] = param1 == 0 ? TriBoolTrue : TriBoolFalse;
+    int8_t low  = 0;
+    int8_t high = sizeof(_urcTable) / sizeof(_urcTable[0]) - 1;
 
-        return true;
+    while (low <= high) {
+        int8_t mid = (low + high) / 2;
+        int    cmp = strncmp(buffer, _urcTable[mid].token, tokenLength);
+
+        if (cmp == 0 && _urcTable[mid].token[tokenLength] != '\0') {
+            cmp = -1; // the token is a prefix of the table entry
+        }
+
+        if (cmp == 0) {
+            handled = (this->*_urcTable[mid].method)(params);
+            break;
+        }
+
+        if (cmp < 0) {
+            high = mid - 1;
+        }
+        else {
+            low = mid + 1;
+        }
     }
 
-    if (sscanf(buffer, "+UUHTTPCR: 0,%d,%d", &param1, &param2) == 2) {
-        static uint8_t mapping[] = {
-            HEAD,   // 0
-            GET,    // 1
-            DELETE, // 2
-            PUT,    // 3
-            POST,   // 4
-        };
-
-        int requestType = param1 < (int)sizeof(mapping) ? mapping[param1] : -1;
-        if (requestType >= 0) {
-            debugPrint("Unsolicited: UUHTTPCR: ");
-            debugPrint(requestType);
-            debugPrint(": ");
-            debugPrintln(param2);
-
-            if (param2 == 0) {
-                _httpRequestSuccessBit[requestType] = TriBoolFalse;
-            }
-            else if (param2 == 1) {
-                _httpRequestSuccessBit[requestType] = TriBoolTrue;
-            }
+    for (uint8_t i = 0; i < _urcHandlerCount; i++) {
+        const char* token = _urcHandlers[i].token;
+
+        if ((strncmp(buffer, token, tokenLength) == 0) && (token[tokenLength] == '\0')) {
+            // the handler gets the token separately, without the copy of the line
+            char tokenBuffer[16];
+            size_t n = min(tokenLength, sizeof(tokenBuffer) - 1);
+            memcpy(tokenBuffer, buffer, n);
+            tokenBuffer[n] = '\0';
+
+            _urcHandlers[i].handler(tokenBuffer, params);
+            handled = true;
         }
+    }
 
-        return true;
+    return handled;
+}
+
+// The modem reports a change of its functionality level after a reset or a CFUN change it made itself,
+// the settings that don't survive it have to be sent again even if echo is still off.
+bool Sodaq_R4X::onFunctionalityURC(const char* params)
+{
+    // +CFUN: <fun>
+    int32_t fun;
+
+    if (parseIntFields(&params, &fun, 1) != 1) {
+        return false;
     }
 
-    if (sscanf(buffer, "+UUMQTTC: 1,%d", &param1) == 1) {
-        debugPrint("Unsolicited: MQTT login result: ");
-        debugPrintln(param1);
+    infoPrintf("Unsolicited: functionality level: %ld, modem settings need to be restored", (long)fun);
 
-        _mqttLoginResult = param1;
+    invalidateConfigCache(false);
 
-        return true;
+    _config.radioActive = (fun == 1) ? TriBoolTrue : TriBoolFalse;
+
+    return true;
+}
+
+bool Sodaq_R4X::onFOTAStatusURC(const char* params)
+{
+    int32_t fields[2];
+
+    if (parseIntFields(&params, fields, 2) != 2) {
+        return false;
     }
 
-    if (sscanf(buffer, "+UUMQTTC: 4,%d,%d,\"%[^\"]\"", &param1, &param2, param3) == 3) {
-        debugPrint("Unsolicited: MQTT subscription result: ");
-        debugPrint(param1);
-        debugPrint(", ");
-        debugPrint(param2);
-        debugPrint(", ");
-        debugPrintln(param3);
+    debugPrintf("Unsolicited: FOTA: %ld, %ld", (long)fields[0], (long)fields[1]);
 
-       _mqttSubscribeReason = param1;
+    return true;
+}
 
-        return true;
+bool Sodaq_R4X::onHTTPErrorURC(const char* params)
+{
+    // +UHTTPER: 0,<error class>,<error code>
+    int32_t fields[3];
+
+    if (parseIntFields(&params, fields, 3) != 3 || fields[0] != 0) {
+        return false;
     }
 
-    if (sscanf(buffer, "+UUMQTTCM: 6,%d", &param1) == 1) {
-        debugPrint("Unsolicited: MQTT pending messages:");
-        debugPrintln(param1);
+    debugPrintf("Unsolicited: UHTTPER: %ld", (long)fields[2]);
 
-        _mqttPendingMessages = param1;
+    _httpRequestSuccessBit[1] = fields[2] == 0 ? TriBoolTrue : TriBoolFalse;
 
-        return true;
+    return true;
+}
+
+bool Sodaq_R4X::onHTTPResultURC(const char* params)
+{
+    static uint8_t mapping[] = {
+        HEAD,   // 0
+        GET,    // 1
+        DELETE, // 2
+        PUT,    // 3
+        POST,   // 4
+    };
+
+    // +UUHTTPCR: 0,<command>,<result>
+    int32_t fields[3];
+
+    if (parseIntFields(&params, fields, 3) != 3 || fields[0] != 0) {
+        return false;
     }
 
-    if (sscanf(buffer, "+UUSORD: %d,%d", &param1, &param2) == 2) {
-        debugPrint("Unsolicited: Socket ");
-        debugPrint(param1);
-        debugPrint(": ");
-        debugPrintln(param2);
+    int requestType = (fields[1] >= 0 && fields[1] < (int)sizeof(mapping)) ? mapping[fields[1]] : -1;
+    if (requestType >= 0) {
+        debugPrintf("Unsolicited: UUHTTPCR: %d: %ld", requestType, (long)fields[2]);
 
-        if (param1 >= 0 && param1 < SOCKET_COUNT) {
-            _socketPendingBytes[param1] = param2;
+        if (fields[2] == 0) {
+            _httpRequestSuccessBit[requestType] = TriBoolFalse;
+        }
+        else if (fields[2] == 1) {
+            _httpRequestSuccessBit[requestType] = TriBoolTrue;
         }
+    }
+
+    return true;
+}
+
+bool Sodaq_R4X::onMQTTCommandURC(const char* params)
+{
+    // +UUMQTTC: 1,<result> or +UUMQTTC: 4,<result>,<qos>,"<topic>"
+    int32_t fields[3];
+    uint8_t count = parseIntFields(&params, fields, 3);
+
+    if (count == 2 && fields[0] == 1) {
+        infoPrintf("Unsolicited: MQTT login result: %ld", (long)fields[1]);
+
+        _mqttLoginResult = fields[1];
 
         return true;
     }
 
-    if (sscanf(buffer, "+UUSORF: %d,%d", &param1, &param2) == 2) {
-        debugPrint("Unsolicited: Socket ");
-        debugPrint(param1);
-        debugPrint(": ");
-        debugPrintln(param2);
+    if (count == 3 && fields[0] == 4) {
+        debugPrintf("Unsolicited: MQTT subscription result: %ld, %ld, %s", (long)fields[1], (long)fields[2], params);
 
-        if (param1 >= 0 && param1 < SOCKET_COUNT) {
-            _socketPendingBytes[param1] = param2;
-        }
+        _mqttSubscribeReason = fields[1];
 
         return true;
     }
 
-    if (sscanf(buffer, "+UUSOCL: %d", &param1) == 1) {
-        debugPrint("Unsolicited: Socket ");
-        debugPrintln(param1);
+    return false;
+}
 
-        if (param1 >= 0 && param1 < SOCKET_COUNT) {
-            _socketClosedBit[param1] = true;
-        }
+bool Sodaq_R4X::onMQTTMessagesURC(const char* params)
+{
+    // +UUMQTTCM: 6,<messages>
+    int32_t fields[2];
+
+    if (parseIntFields(&params, fields, 2) != 2 || fields[0] != 6) {
+        return false;
+    }
+
+    debugPrintf("Unsolicited: MQTT pending messages:%ld", (long)fields[1]);
+
+    _mqttPendingMessages = fields[1];
+
+    return true;
+}
+
+bool Sodaq_R4X::onPSMStateURC(const char* params)
+{
+    // +UUPSMR: <state>[,<param>]
+    int32_t state;
+
+    if (parseIntFields(&params, &state, 1) != 1) {
+        return false;
+    }
+
+    infoPrintf("Unsolicited: PSM state: %ld", (long)state);
+
+    _psmState = state;
+
+    return true;
+}
+
+bool Sodaq_R4X::onRegistrationURC(const char* params)
+{
+    // +CEREG: <stat>[,<tac>,<ci>,<AcT>...]
+    int32_t status;
+
+    if (parseIntFields(&params, &status, 1) != 1) {
+        return false;
+    }
+
+    infoPrintf("Unsolicited: Registration status: %ld", (long)status);
+
+    _registrationStatus = status;
+
+    // "<tac>","<ci>",... follow the status with +CEREG=2 or higher
+    char cellId[12];
+
+    if (getCsvField(params, 1, cellId, sizeof(cellId)) && (cellId[0] != '\0')) {
+        _lastCellId = strtoul(cellId, NULL, 16);
+    }
+
+    return true;
+}
+
+bool Sodaq_R4X::onSocketClosedURC(const char* params)
+{
+    int32_t socketID;
+
+    if (parseIntFields(&params, &socketID, 1) != 1) {
+        return false;
+    }
+
+    debugPrintf("Unsolicited: Socket %ld", (long)socketID);
+
+    if (socketID >= 0 && socketID < SOCKET_COUNT) {
+        _socketClosedBit[socketID] = true;
+    }
+
+    return true;
+}
+
+bool Sodaq_R4X::onSocketDataURC(const char* params)
+{
+    // +UUSORD: <socket>,<length> or +UUSORF: <socket>,<length>
+    int32_t fields[2];
+
+    if (parseIntFields(&params, fields, 2) != 2) {
+        return false;
+    }
+
+    debugPrintf("Unsolicited: Socket %ld: %ld", (long)fields[0], (long)fields[1]);
+
+    if (fields[0] >= 0 && fields[0] < SOCKET_COUNT) {
+        _socketPendingBytes[fields[0]] = fields[1];
+    }
+
+    return true;
+}
+
+// Makes sure the modem uses the selected socket data mode (hex or binary).
+// The command is only sent when the last confirmed mode is different or unknown.
+bool Sodaq_R4X::checkSocketDataMode()
+{
+    tribool_t required = _socketBinaryMode ? TriBoolFalse : TriBoolTrue;
+
+    if (_config.socketHexMode == required) {
+        return true;
+    }
+
+    print("AT+UDCONF=1,");
+    println(_socketBinaryMode ? '0' : '1');
+
+    if (readResponse() != GSMResponseOK) {
+        _config.socketHexMode = TriBoolUndefined;
+        return false;
+    }
+
+    _config.socketHexMode = required;
+
+    return true;
+}
+
+// Forgets the last confirmed modem settings, so that the next connect() sends them again.
+// The settings stored in the modem NVM are only forgotten when "nvmSettings" is true.
+void Sodaq_R4X::invalidateConfigCache(bool nvmSettings)
+{
+    _config.psmDisabled    = TriBoolUndefined;
+    _config.psmUrcEnabled  = TriBoolUndefined;
+    _config.ceregMode      = -1;
+    _config.verboseErrors  = -1;
+    _config.networkLEDMode = -1;
+    _config.echoOff        = TriBoolUndefined;
+    _config.radioActive    = TriBoolUndefined;
+    _config.socketHexMode  = TriBoolUndefined;
+    _config.baudrate       = 0;
+
+    _config.operatorSelect[0] = '\0';
+
+    if (nvmSettings) {
+        _config.mnoProfileRequested = -1;
 
-        return true;
+        memset(_config.urat, 0, sizeof(_config.urat));
+        memset(_config.bandMaskLTE, 0, sizeof(_config.bandMaskLTE));
+        memset(_config.bandMaskNB, 0, sizeof(_config.bandMaskNB));
     }
-
-    return false;
 }
 
 bool Sodaq_R4X::doSIMcheck()
@@ -2412,7 +3978,7 @@ bool Sodaq_R4X::doSIMcheck()
         SimStatuses simStatus = getSimStatus();
         if (simStatus == SimNeedsPin) {
             if (_pin == 0 || *_pin == '\0' || !setSimPin(_pin)) {
-                debugPrintln(DEBUG_STR_ERROR "SIM needs a PIN but none was provided, or setting it failed!");
+                errorPrintf(DEBUG_STR_ERROR "SIM needs a PIN but none was provided, or setting it failed!");
                 return false;
             }
         }
@@ -2426,12 +3992,41 @@ bool Sodaq_R4X::doSIMcheck()
 
 bool Sodaq_R4X::setNetworkLEDState()
 {
+    int16_t mode = _networkStatusLED ? 2 : 255;
+
+    if (_config.networkLEDMode == mode) {
+        return true;
+    }
+
     print("AT+UGPIOC=");
     print(NETWORK_STATUS_GPIO_ID);
     print(',');
-    (_networkStatusLED) ? println("2") : println("255");
+    println(mode);
 
-    return (readResponse() == GSMResponseOK);
+    if (readResponse() != GSMResponseOK) {
+        _config.networkLEDMode = -1;
+        return false;
+    }
+
+    _config.networkLEDMode = mode;
+
+    return true;
+}
+
+bool Sodaq_R4X::setEchoOff()
+{
+    if (_config.echoOff == TriBoolTrue) {
+        return true;
+    }
+
+    if (!execCommand("ATE0")) {
+        _config.echoOff = TriBoolUndefined;
+        return false;
+    }
+
+    _config.echoOff = TriBoolTrue;
+
+    return true;
 }
 
 bool Sodaq_R4X::isValidIPv4(const char* str)
@@ -2505,6 +4100,11 @@ GSMResponseTypes Sodaq_R4X::readResponse(char* outBuffer, size_t outMaxSize, con
     bool usePrefix    = prefix != NULL && prefix[0] != 0;
     bool useOutBuffer = outBuffer != NULL && outMaxSize > 0;
 
+    // the response of a queued command in progress is not ours
+    if (_commandStarted) {
+        finishCommands();
+    }
+
     uint32_t from = NOW;
 
     size_t outSize = 0;
@@ -2525,6 +4125,12 @@ GSMResponseTypes Sodaq_R4X::readResponse(char* outBuffer, size_t outMaxSize, con
         debugPrintln(_inputBuffer);
 
         if (startsWith(STR_AT, _inputBuffer)) {
+            if (_config.echoOff == TriBoolTrue) {
+                // echo is back on, the modem has been reset behind our back
+                debugPrintln("Unexpected echo, modem settings need to be restored");
+                invalidateConfigCache(false);
+            }
+
             continue; // skip echoed back command
         }
 
@@ -2544,7 +4150,7 @@ GSMResponseTypes Sodaq_R4X::readResponse(char* outBuffer, size_t outMaxSize, con
 
         bool hasPrefix = usePrefix && useOutBuffer && startsWith(prefix, _inputBuffer);
 
-        if (!hasPrefix && checkURC(_inputBuffer)) {
+        if (!hasPrefix && !isExecCommandReply(_inputBuffer) && checkURC(_inputBuffer)) {
             continue;
         }
 
@@ -2575,8 +4181,159 @@ GSMResponseTypes Sodaq_R4X::readResponse(char* outBuffer, size_t outMaxSize, con
     return GSMResponseTimeout;
 }
 
+size_t Sodaq_R4X::readSocketData(const char* prefix, bool hasRemote, uint8_t* buffer, size_t size, int* socketID,
+                                 uint32_t timeout)
+{
+    size_t   prefixLen = strlen(prefix);
+    uint32_t from      = NOW;
+    bool     matched   = false;
+
+    while (!matched && !is_timedout(from, timeout)) {
+        // match the start of the line against the prefix, character by character
+        size_t index = 0;
+        int    c     = -1;
+
+        while (index < prefixLen) {
+            c = timedRead(250);
+
+            if (c != prefix[index]) {
+                break;
+            }
+
+            index++;
+        }
+
+        if (index == prefixLen) {
+            matched = true;
+            break;
+        }
+
+        sodaq_wdt_reset();
+
+        if (c < 0 || (index == 0 && (c == CR || c == LF))) {
+            continue; // nothing read or an empty line
+        }
+
+        // not the data response, assemble the rest of the line and handle it like readResponse() does
+        memcpy(_inputBuffer, prefix, index);
+        size_t count = index;
+
+        if (c != LF) {
+            _inputBuffer[count++] = c;
+            count += readLn(_inputBuffer + count, _inputBufferSize - count, 250);
+        }
+
+        if (count > 0 && _inputBuffer[count - 1] == CR) {
+            count--;
+        }
+
+        _inputBuffer[count] = '\0';
+
+        debugPrint("<< ");
+        debugPrintln(_inputBuffer);
+
+        if (startsWith(STR_RESPONSE_OK, _inputBuffer) ||
+                startsWith(STR_RESPONSE_ERROR, _inputBuffer) ||
+                startsWith(STR_RESPONSE_CME_ERROR, _inputBuffer) ||
+                startsWith(STR_RESPONSE_CMS_ERROR, _inputBuffer)) {
+            return 0;
+        }
+
+        checkURC(_inputBuffer);
+    }
+
+    if (!matched) {
+        debugPrintln("<< timed out");
+        return 0;
+    }
+
+    uint32_t id;
+    uint32_t length;
+
+    if (!readNumber(',', &id)) {
+        return 0;
+    }
+
+    if (hasRemote) {
+        // skip the quoted remote IP and the remote port
+        if (timedRead() != '"') {
+            return 0;
+        }
+
+        int c;
+
+        do {
+            c = timedRead();
+        } while (c >= 0 && c != '"');
+
+        if ((c < 0) || (timedRead() != ',')) {
+            return 0;
+        }
+
+        uint32_t port;
+
+        if (!readNumber(',', &port)) {
+            return 0;
+        }
+    }
+
+    if (!readNumber(',', &length) || (timedRead() != '"')) {
+        return 0;
+    }
+
+    debugPrint("<< ");
+    debugPrint(prefix);
+    debugPrint(id);
+    debugPrint(',');
+    debugPrintln(length);
+
+    // decode the data directly into the buffer, anything not fitting is read and dropped
+    for (uint32_t i = 0; i < length; i++) {
+        int high = timedRead();
+
+        if (high < 0) {
+            return 0;
+        }
+
+        if (_socketBinaryMode) {
+            if (buffer != NULL && i < size) {
+                buffer[i] = high;
+            }
+
+            continue;
+        }
+
+        int low = timedRead();
+
+        if (low < 0) {
+            return 0;
+        }
+
+        if (buffer != NULL && i < size) {
+            buffer[i] = HEX_PAIR_TO_BYTE(high, low);
+        }
+    }
+
+    if (timedRead() != '"') {
+        return 0;
+    }
+
+    if ((id >= SOCKET_COUNT) || (readResponse() != GSMResponseOK)) {
+        return 0;
+    }
+
+    *socketID = id;
+
+    // only the bytes that fitted were stored in the buffer
+    return min((size_t)length, size);
+}
+
 void Sodaq_R4X::reboot()
 {
+    flushCommands();
+
+    invalidateConfigCache(false);
+
     println("AT+CFUN=15");
 
     // wait up to 2000ms for the modem to come up
@@ -2584,17 +4341,19 @@ void Sodaq_R4X::reboot()
 
     while ((readResponse() != GSMResponseOK) && !is_timedout(start, 2000)) {}
 
-    // wait for the reboot to start
-    sodaq_wdt_safe_delay(REBOOT_DELAY);
+    // wait for the reboot to start, which V_INT shows if the board has it
+    waitForPowerDown(REBOOT_DELAY);
 
     while (!is_timedout(start, REBOOT_TIMEOUT)) {
-        if (getSimStatus() == SimReady) {
+        if (syncBaudrate() && (getSimStatus() == SimReady)) {
             break;
         }
     }
 
     // echo off again after reboot
-    execCommand("ATE0");
+    setEchoOff();
+
+    restoreBaudrate();
 
     // extra read just to clear the input stream
     readResponse(NULL, 0, NULL, 250);
@@ -2616,7 +4375,7 @@ bool Sodaq_R4X::waitForSignalQuality(uint32_t timeout)
     int8_t rssi;
     uint8_t ber;
 
-    uint32_t delay_count = 500;
+    Backoff backoff = { CSQ_BACKOFF_MIN, CSQ_BACKOFF_MAX };
 
     while (!is_timedout(start, timeout)) {
         if (getRSSIAndBER(&rssi, &ber)) {
@@ -2627,17 +4386,68 @@ bool Sodaq_R4X::waitForSignalQuality(uint32_t timeout)
             }
         }
 
-        sodaq_wdt_safe_delay(delay_count);
+        backoffWait(&backoff);
+    }
+
+    return false;
+}
+
+// Waits between half and all of the current delay of "backoff", then doubles the delay for the next time.
+// The random part keeps devices that lost the network at the same time from retrying in lockstep;
+// it comes from the microsecond clock, which drifts apart between devices.
+// Stops early only once "until" (optional) is set, see idleWait().
+void Sodaq_R4X::backoffWait(Backoff* backoff, const tribool_t* until)
+{
+    uint32_t half = backoff->delay / 2;
+
+    idleWait(half + (micros() % (half + 1)), until);
+
+    backoff->delay = min(backoff->delay * 2, backoff->maxDelay);
+}
+
+// Waits until V_INT shows the modem is down, or for the whole "timeout" if the board can't tell.
+void Sodaq_R4X::waitForPowerDown(uint32_t timeout)
+{
+    if (!_onoff || (_onoff->isPowered() == TriBoolUndefined)) {
+        sodaq_wdt_safe_delay(timeout);
+        return;
+    }
+
+    uint32_t start = millis();
+
+    while ((_onoff->isPowered() == TriBoolTrue) && !is_timedout(start, timeout)) {
+        sodaq_wdt_safe_delay(10);
+    }
+}
+
+// Sleeps for "ms" milliseconds, handling the modem lines as they come in.
+// Other URCs don't end the wait, only "until" (optional) leaving TriBoolUndefined, e.g. the flag
+// the URC a loop is waiting for sets. Returns true if it stopped early because of that.
+bool Sodaq_R4X::idleWait(uint32_t ms, const tribool_t* until)
+{
+    uint32_t start = millis();
+
+    while (!is_timedout(start, ms)) {
+        sodaq_wdt_reset();
 
-        // Next time wait a little longer, but not longer than 5 seconds
-        if (delay_count < 5000) {
-            delay_count += 1000;
+        if (poll() && until && (*until != TriBoolUndefined)) {
+            return true;
         }
+
+        idleSleep();
     }
 
     return false;
 }
 
+// Sleeps until the next interrupt: the UART receiving or the millis() tick.
+void Sodaq_R4X::idleSleep()
+{
+#ifdef ARDUINO_ARCH_SAMD
+    __WFI();
+#endif
+}
+
 
 /******************************************************************************
 * Utils
@@ -2660,6 +4470,43 @@ uint32_t Sodaq_R4X::convertDatetimeToEpoch(int y, int m, int d, int h, int min,
     return mktime(&tm);
 }
 
+// Parses up to "count" comma separated integers from "str" into "fields".
+// Parsing stops at the first field that is not an integer (e.g. a quoted string).
+// "str" is moved past the parsed fields. Returns the number of fields parsed.
+uint8_t Sodaq_R4X::parseIntFields(const char** str, int32_t* fields, uint8_t count)
+{
+    const char* p = *str;
+    uint8_t parsed = 0;
+
+    while (parsed < count) {
+        bool negative = (*p == '-');
+        const char* digits = negative ? p + 1 : p;
+
+        if (*digits < '0' || *digits > '9') {
+            break;
+        }
+
+        int32_t value = 0;
+
+        while (*digits >= '0' && *digits <= '9') {
+            value = value * 10 + (*digits++ - '0');
+        }
+
+        fields[parsed++] = negative ? -value : value;
+        p = digits;
+
+        if (*p != ',') {
+            break;
+        }
+
+        p++;
+    }
+
+    *str = p;
+
+    return parsed;
+}
+
 bool Sodaq_R4X::startsWith(const char* pre, const char* str)
 {
     return (strncmp(pre, str, strlen(pre)) == 0);
@@ -2684,6 +4531,11 @@ bool Sodaq_R4X::isOn() const
 void Sodaq_R4X::writeProlog()
 {
     if (!_appendCommand) {
+        // a blocking command must not interleave with the queued ones
+        if ((_commandCount > 0) && !_sendingCommand) {
+            finishCommands();
+        }
+
         debugPrint(">> ");
         _appendCommand = true;
     }
@@ -2695,6 +4547,22 @@ size_t Sodaq_R4X::writeByte(uint8_t value)
     return _modemStream->write(value);
 }
 
+// Write a buffer as hex characters.
+// The characters are encoded into a block on the stack and sent with a single write per block,
+// rather than going through print(char) twice for every byte.
+size_t Sodaq_R4X::writeHex(const uint8_t* buffer, size_t size)
+{
+    writeProlog();
+
+    #if SODAQ_LOG_LEVEL >= SODAQ_LOG_LEVEL_DEBUG
+    Stream* mirror = _diagStream;
+    #else
+    Stream* mirror = NULL;
+    #endif
+
+    return writeHexChunked(_modemStream, mirror, buffer, size);
+}
+
 size_t Sodaq_R4X::print(const String& buffer)
 {
     writeProlog();
@@ -2844,20 +4712,60 @@ void Sodaq_R4X::setModemStream(Stream& stream)
     _modemStream = &stream;
 }
 
-// Returns a character from the modem stream if read within _timeout ms or -1 otherwise.
-int Sodaq_R4X::timedRead(uint32_t timeout) const
+// Moves everything the modem stream has available into the receive ring, as far as it fits.
+// Returns the number of characters moved.
+size_t Sodaq_R4X::fillRxRing()
 {
-    uint32_t _startMillis = millis();
+    size_t count = 0;
+    int available = _modemStream->available();
 
-    do {
+    while ((available-- > 0) && ((uint16_t)(_rxHead - _rxTail) < SODAQ_R4X_RX_RING_SIZE)) {
         int c = _modemStream->read();
 
-        if (c >= 0) {
-            return c;
+        if (c < 0) {
+            break;
+        }
+
+        _rxRing[_rxHead++ & (SODAQ_R4X_RX_RING_SIZE - 1)] = static_cast<uint8_t>(c);
+        count++;
+    }
+
+    return count;
+}
+
+// Returns true if the receive ring holds a line terminator or is full.
+bool Sodaq_R4X::hasRxLine() const
+{
+    uint16_t count = _rxHead - _rxTail;
+
+    if (count >= SODAQ_R4X_RX_RING_SIZE) {
+        return true;
+    }
+
+    for (uint16_t i = _rxTail; i != _rxHead; i++) {
+        if (_rxRing[i & (SODAQ_R4X_RX_RING_SIZE - 1)] == SODAQ_GSM_TERMINATOR[SODAQ_GSM_TERMINATOR_LEN - 1]) {
+            return true;
+        }
+    }
+
+    // the modem does not terminate its data prompts
+    return (count == 1) && ((_rxRing[_rxTail & (SODAQ_R4X_RX_RING_SIZE - 1)] == STR_RESPONSE_SOCKET_PROMPT) ||
+        (_rxRing[_rxTail & (SODAQ_R4X_RX_RING_SIZE - 1)] == STR_RESPONSE_FILE_PROMPT));
+}
+
+// Returns a character from the modem stream if read within _timeout ms or -1 otherwise.
+int Sodaq_R4X::timedRead(uint32_t timeout)
+{
+    uint32_t _startMillis = millis();
+
+    // only look at the clock while there is nothing to read
+    while ((_rxHead == _rxTail) && (fillRxRing() == 0)) {
+        if (millis() - _startMillis >= timeout) {
+            return -1; // -1 indicates timeout
         }
-    } while (millis() - _startMillis < timeout);
+    }
 
-    return -1; // -1 indicates timeout
+    return _rxRing[_rxTail++ & (SODAQ_R4X_RX_RING_SIZE - 1)];
 }
 
 // Fills the given "buffer" with characters read from the modem stream up to "length"
@@ -2898,30 +4806,84 @@ size_t Sodaq_R4X::readBytes(uint8_t* buffer, size_t length, uint32_t timeout)
     size_t count = 0;
 
     while (count < length) {
-        int c = timedRead(timeout);
+        if (_rxHead == _rxTail) {
+            int c = timedRead(timeout);
 
-        if (c < 0) {
-            break;
+            if (c < 0) {
+                break;
+            }
+
+            *buffer++ = static_cast<uint8_t>(c);
+            count++;
+            continue;
         }
 
-        *buffer++ = static_cast<uint8_t>(c);
-        count++;
+        // copy the contiguous part of the ring in one go
+        size_t offset = _rxTail & (SODAQ_R4X_RX_RING_SIZE - 1);
+        size_t chunk  = min((size_t)(uint16_t)(_rxHead - _rxTail), (size_t)(SODAQ_R4X_RX_RING_SIZE - offset));
+        chunk = min(chunk, length - count);
+
+        memcpy(buffer, &_rxRing[offset], chunk);
+        buffer  += chunk;
+        count   += chunk;
+        _rxTail += chunk;
     }
 
     return count;
 }
 
+// Reads a decimal number from the modem stream, up to the "terminator" character.
+// Returns false if a non-digit character is read or a character read times out.
+bool Sodaq_R4X::readNumber(char terminator, uint32_t* value, uint32_t timeout)
+{
+    uint32_t result = 0;
+    size_t   digits = 0;
+
+    while (true) {
+        int c = timedRead(timeout);
+
+        if (c == terminator && digits > 0) {
+            *value = result;
+            return true;
+        }
+
+        if (c < '0' || c > '9') {
+            return false;
+        }
+
+        result = result * 10 + (c - '0');
+        digits++;
+    }
+}
+
 // Reads a line (up to the SODAQ_GSM_TERMINATOR) from the modem stream into the "buffer".
 // The buffer is terminated with null.
 // Returns the number of bytes read, not including the null terminator.
 size_t Sodaq_R4X::readLn(char* buffer, size_t size, uint32_t timeout)
 {
+    const char terminator = SODAQ_GSM_TERMINATOR[SODAQ_GSM_TERMINATOR_LEN - 1];
+    size_t len = 0;
+
     // Use size-1 to leave room for a string terminator
-    size_t len = readBytesUntil(SODAQ_GSM_TERMINATOR[SODAQ_GSM_TERMINATOR_LEN - 1], buffer, size - 1, timeout);
+    while (len < size - 1) {
+        // the modem does not terminate its data prompts, so don't wait for more after one
+        if ((len == 1) && (_rxHead == _rxTail) && (fillRxRing() == 0) &&
+                ((buffer[0] == STR_RESPONSE_SOCKET_PROMPT) || (buffer[0] == STR_RESPONSE_FILE_PROMPT))) {
+            break;
+        }
+
+        int c = timedRead(timeout);
+
+        if (c < 0 || c == terminator) {
+            break;
+        }
+
+        buffer[len++] = static_cast<char>(c);
+    }
 
     // check if the terminator is more than 1 characters, then check if the first character of it exists
     // in the calculated position and terminate the string there
-    if ((SODAQ_GSM_TERMINATOR_LEN > 1) && (buffer[len - (SODAQ_GSM_TERMINATOR_LEN - 1)] == SODAQ_GSM_TERMINATOR[0])) {
+    if ((SODAQ_GSM_TERMINATOR_LEN > 1) && (len > 0) && (buffer[len - (SODAQ_GSM_TERMINATOR_LEN - 1)] == SODAQ_GSM_TERMINATOR[0])) {
         len -= SODAQ_GSM_TERMINATOR_LEN - 1;
     }
 
@@ -2948,9 +4910,16 @@ Sodaq_SARA_R4XX_OnOff::Sodaq_SARA_R4XX_OnOff()
     #endif
 
     _onoff_status = false;
+    _vintPin = -1;
 }
 
 void Sodaq_SARA_R4XX_OnOff::on()
+{
+    sodaq_wdt_safe_delay(beginOn());
+    endOn();
+}
+
+uint32_t Sodaq_SARA_R4XX_OnOff::beginOn()
 {
     #ifdef PIN_SARA_ENABLE
     digitalWrite(SARA_ENABLE, HIGH);
@@ -2958,14 +4927,40 @@ void Sodaq_SARA_R4XX_OnOff::on()
 
     pinMode(SARA_R4XX_TOGGLE, OUTPUT);
     digitalWrite(SARA_R4XX_TOGGLE, LOW);
-    // We should be able to reduce this to 50ms or something
-    sodaq_wdt_safe_delay(2000);
+
+    return SODAQ_R4X_PWR_ON_PULSE;
+    #else
+    return 0;
+    #endif
+}
+
+void Sodaq_SARA_R4XX_OnOff::endOn()
+{
+    #ifdef PIN_SARA_ENABLE
     pinMode(SARA_R4XX_TOGGLE, INPUT);
 
     _onoff_status = true;
     #endif
 }
 
+tribool_t Sodaq_SARA_R4XX_OnOff::isPowered()
+{
+    if (_vintPin < 0) {
+        return TriBoolUndefined;
+    }
+
+    return (digitalRead(_vintPin) == HIGH) ? TriBoolTrue : TriBoolFalse;
+}
+
+void Sodaq_SARA_R4XX_OnOff::setVIntPin(int8_t pin)
+{
+    _vintPin = pin;
+
+    if (pin >= 0) {
+        pinMode(pin, INPUT);
+    }
+}
+
 void Sodaq_SARA_R4XX_OnOff::off()
 {
     #ifdef PIN_SARA_ENABLE
@@ -33,10 +33,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #define _Sodaq_R4X_h
 
 #define DEFAULT_READ_MS                 5000
+#define ISALIVE_TIMEOUT                 450
 #define SODAQ_MAX_SEND_MESSAGE_SIZE     512
 #define SODAQ_R4X_DEFAULT_CID           1
 #define SODAQ_R4X_DEFAULT_READ_TIMOUT   15000
 #define SODAQ_R4X_MAX_SOCKET_BUFFER     1024
+#define SODAQ_R4X_MAX_SOCKET_HEX_WRITE  512
 
 #define SODAQ_R4X_LTEM_URAT             "7"
 #define SODAQ_R4X_NBIOT_URAT            "8"
@@ -50,6 +52,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #define AUTOMATIC_OPERATOR              "0"
 #define BAND_MASK_UNCHANGED             0
 
+#define EDRX_ACT_LTEM                   4
+#define EDRX_ACT_NBIOT                  5
+#define EDRX_DISABLED                   0xFF
+
 #include "Arduino.h"
 
 enum GSMResponseTypes {
@@ -94,6 +100,15 @@ enum SimStatuses {
     SimReady
 };
 
+// The steps of beginPowerOn() / pollPowerOn().
+enum PowerOnStates {
+    PowerOnIdle = 0,
+    PowerOnPulse,      // PWR_ON is held low
+    PowerOnBooting,    // waiting for the modem to answer
+    PowerOnReady,
+    PowerOnFailed
+};
+
 enum TriBoolStates
 {
     TriBoolFalse,
@@ -110,6 +125,121 @@ typedef void(*PublishHandlerPtr)(const char* topic, const char* msg);
 
 #define SOCKET_COUNT 7
 
+// Interval of the AT+USORD/AT+USORF query made while waiting for socket data, in case a
+// +UUSORD/+UUSORF URC was missed. Set to 0 to rely on the URCs only.
+#ifndef SODAQ_R4X_SOCKET_POLL_INTERVAL
+#define SODAQ_R4X_SOCKET_POLL_INTERVAL 5000
+#endif
+
+// Size of the receive buffer of each socket, which socketWaitForRead() and socketSelect() fill
+// with the data pending on the other TCP sockets (not the ones waited for); must be a power of two.
+#ifndef SODAQ_R4X_SOCKET_RX_BUFFER_SIZE
+#define SODAQ_R4X_SOCKET_RX_BUFFER_SIZE 64
+#endif
+
+// Number of operations kept in the telemetry ring; the oldest ones are overwritten.
+#ifndef SODAQ_R4X_TELEMETRY_SIZE
+#define SODAQ_R4X_TELEMETRY_SIZE 16
+#endif
+
+// Size of the windows httpReadBody() reads the response body in (on the stack).
+#ifndef SODAQ_R4X_HTTP_WINDOW_SIZE
+#define SODAQ_R4X_HTTP_WINDOW_SIZE 128
+#endif
+
+// Size of the chunks httpRequestFromProducer() writes the request body in (on the stack).
+// Each chunk is an AT+UDWNFILE round trip.
+#ifndef SODAQ_R4X_HTTP_UPLOAD_CHUNK_SIZE
+#define SODAQ_R4X_HTTP_UPLOAD_CHUNK_SIZE 512
+#endif
+
+#ifndef SODAQ_R4X_MAX_URC_HANDLERS
+#define SODAQ_R4X_MAX_URC_HANDLERS 4
+#endif
+
+// Size of the receive ring the modem stream is drained into; must be a power of two.
+#ifndef SODAQ_R4X_RX_RING_SIZE
+#define SODAQ_R4X_RX_RING_SIZE 256
+#endif
+
+// Number of commands that can be queued with submitCommand().
+#ifndef SODAQ_R4X_MAX_QUEUED_COMMANDS
+#define SODAQ_R4X_MAX_QUEUED_COMMANDS 4
+#endif
+
+#define SODAQ_R4X_MAX_QUEUED_COMMAND_LENGTH 96
+#define SODAQ_R4X_QUEUED_RESPONSE_SIZE      64
+
+// Called with the URC token (e.g. "+CEREG") and the parameters after the colon.
+typedef void(*URCHandlerPtr)(const char* token, const char* params);
+
+// Called when a queued command completes, with the handle returned by submitCommand(), the result
+// and the response lines collected for it (separated by LF). The response is only valid during the call,
+// until the callback issues a command itself. Called at the end of poll(), once it is done with the
+// modem stream, so the callback can issue blocking commands. off() and reboot() fail the commands
+// still queued with GSMResponseError.
+typedef void(*CommandCallbackPtr)(uint8_t handle, GSMResponseTypes result, const char* response, void* context);
+
+// Called to switch the UART of the modem stream to another baud rate, e.g. with Serial1.begin(baudrate).
+typedef void(*BaudrateChangeHandlerPtr)(uint32_t baudrate);
+
+// Called with the next window of an HTTP response body; "offset" is its position in the body of "bodySize" bytes.
+// The data is only valid during the call. Returning false stops the reading.
+typedef bool(*HttpBodyHandlerPtr)(const uint8_t* data, size_t size, uint32_t offset, uint32_t bodySize, void* context);
+
+// Called to produce the next part of an HTTP request body into "buffer", of at most "size" bytes.
+// Returns the number of bytes produced, 0 when the body is complete.
+typedef size_t(*HttpBodyProducerPtr)(uint8_t* buffer, size_t size, void* context);
+
+// One part of the data for socketWritev().
+struct SocketIoVec {
+    const uint8_t* data;
+    size_t         size;
+};
+
+struct SocketStats {
+    uint32_t bytesSent;
+    uint32_t bytesReceived;
+    uint16_t writeCommands;   // AT+USOWR/AT+USOST commands sent
+    uint16_t readCommands;    // AT+USORD/AT+USORF commands sent
+};
+
+// The operations recorded in the telemetry ring, see Sodaq_R4X::recordTelemetry().
+enum TelemetryOperations {
+    TelemetryAttach = 0,
+    TelemetrySocketConnect,
+    TelemetryMqttConnect,
+    TelemetryMqttPublish,
+    TelemetryOperationsMAX
+};
+
+struct TelemetryRecord {
+    uint32_t time;        // millis() when the operation ended
+    uint32_t duration;    // ms
+    uint32_t cellId;      // 0 if unknown
+    int8_t   rssi;        // dBm, 0 if unknown
+    uint8_t  operation;   // TelemetryOperations
+    bool     success;
+};
+
+// All the records of one operation since clearTelemetry(), also the ones overwritten in the ring.
+struct TelemetrySummary {
+    uint32_t totalDuration; // ms
+    uint16_t count;
+    uint16_t failures;
+};
+
+// What the modem and the SIM report about themselves, see readModemIdentity().
+struct ModemIdentity {
+    char imei[16];               // AT+CGSN
+    char imsi[21];               // AT+CIMI, empty if there is no SIM
+    char ccid[21];               // AT+CCID, empty if there is no SIM
+    char firmwareVersion[48];    // AT+CGMR
+    char firmwareRevision[32];   // ATI9
+    char operatorName[33];       // AT+COPS?, at the time of the query, empty if not registered
+    bool valid;
+};
+
 class Sodaq_OnOffBee
 {
 public:
@@ -117,8 +247,21 @@ public:
     virtual void on()   = 0;
     virtual void off()  = 0;
     virtual bool isOn() = 0;
+
+    // on() in two steps, so that the caller doesn't have to block: beginOn() returns the number
+    // of ms after which endOn() must be called.
+    virtual uint32_t beginOn() { on(); return 0; }
+    virtual void endOn() {}
+
+    // Returns the state of the power indication (V_INT) of the module, TriBoolUndefined if not available.
+    virtual tribool_t isPowered() { return TriBoolUndefined; }
 };
 
+// Length of the PWR_ON low pulse that switches the SARA R4 on, the datasheet allows 0.15 to 3.2 s.
+#ifndef SODAQ_R4X_PWR_ON_PULSE
+#define SODAQ_R4X_PWR_ON_PULSE 200
+#endif
+
 class Sodaq_SARA_R4XX_OnOff : public Sodaq_OnOffBee
 {
 public:
@@ -126,8 +269,15 @@ public:
     void on();
     void off();
     bool isOn();
+    uint32_t beginOn();
+    void endOn();
+    tribool_t isPowered();
+
+    // Sets the pin connected to V_INT of the module, on boards that have one.
+    void setVIntPin(int8_t pin);
 private:
     bool _onoff_status;
+    int8_t _vintPin;
 };
 
 class Sodaq_R4X
@@ -146,6 +296,13 @@ public:
     bool on();
     bool off();
 
+    // Starts turning the modem on and returns immediately, pollPowerOn() takes it from there.
+    void beginPowerOn();
+
+    // Advances the power-on started by beginPowerOn() without blocking (apart from short AT probes)
+    // and returns where it is, PowerOnReady once the modem answers.
+    PowerOnStates pollPowerOn();
+
     // Turns on and initializes the modem, then connects to the network and activates the data connection.
     bool connect(const char* apn, const char* urat = DEFAULT_URAT, 
         const char* bandMask = BAND_MASK_UNCHANGED);
@@ -154,6 +311,15 @@ public:
         const char* operatorSelect = AUTOMATIC_OPERATOR, const char* bandMaskLTE = BAND_MASK_UNCHANGED, 
         const char* bandMaskNB = BAND_MASK_UNCHANGED);
 
+    // Restores the data connection after a link drop with the lightest step that works: reactivating
+    // the PDP context while still registered, re-attaching otherwise, and only then a full connect()
+    // with the parameters of its last call (those strings must stay valid).
+    // Returns false if connect() was never called or all the steps failed.
+    bool reconnect();
+
+    // Returns true if connect() was called before, i.e. reconnect() can do a full connect().
+    bool hasConnectParams() const { return _lastConnect.apn != 0; }
+
     // Disconnects the modem from the network.
     bool disconnect();
 
@@ -161,6 +327,19 @@ public:
     // To be used when initializing the modem stream for the first time.
     uint32_t getDefaultBaudrate() { return 115200; };
 
+    // Sets the handler that switches the modem stream to another baud rate, which setBaudrate() needs.
+    // The stream is expected to run at getDefaultBaudrate() when the handler is set.
+    void setBaudrateChangeHandler(BaudrateChangeHandlerPtr handler) { _baudrateChangeHandler = handler; }
+
+    // Switches the modem UART (AT+IPR) and the stream to the given baud rate, e.g. 460800 or 921600.
+    // The new rate is verified with a few commands, on failure both sides fall back to the default.
+    // The rate is restored by on() and reboot(). If the modem is off it is only applied by the next on().
+    // Returns true if the modem is now running at the given rate (or will be after on()).
+    bool setBaudrate(uint32_t baudrate);
+
+    // Returns the baud rate the modem stream is currently running at.
+    uint32_t getBaudrate() const { return _hostBaudrate; }
+
     // Sets the optional "Diagnostics and Debug" stream.
     void setDiag(Stream &stream) { _diagStream = &stream; }
     void setDiag(Stream *stream) { _diagStream = stream; }
@@ -188,6 +367,31 @@ public:
     SimStatuses getSimStatus();
     bool execCommand(const char* command, uint32_t timeout = DEFAULT_READ_MS, char* buffer = NULL, size_t size = 0);
 
+    // Queues a command to be sent without blocking. poll() sends it and calls "callback" (optional)
+    // when it completes, see CommandCallbackPtr. Only the response lines starting with "prefix" are collected, if given.
+    // Blocking calls wait for the queued commands to complete first.
+    // Returns a handle for the command, or 0 if the queue is full.
+    uint8_t submitCommand(const char* command, uint32_t timeout, CommandCallbackPtr callback,
+        void* context = NULL, const char* prefix = NULL);
+
+    // Reads the identity of the modem and the SIM with a single concatenated command line, or one
+    // command at a time if the modem refuses the line (e.g. without a SIM), and caches it.
+    // getIMEI(), getIMSI(), getCCID(), getFirmwareVersion() and getFirmwareRevision() use the cache.
+    bool readModemIdentity();
+
+    // Returns the cached identity, read first if needed or if "refresh" is true. NULL if it can't be read.
+    const ModemIdentity* getModemIdentity(bool refresh = false);
+
+    // Queries only the operator (AT+COPS?) and updates the cached identity with it, the name is left
+    // empty if not registered. Reads the whole identity if nothing is cached yet.
+    bool refreshOperator();
+
+    // Returns true if the command with the given handle is queued or in progress.
+    bool isCommandPending(uint8_t handle) const;
+
+    // Blocks until all the queued commands have completed.
+    void finishCommands();
+
     // Returns true if the modem replies to "AT" commands without timing out.
     bool isAlive();
 
@@ -201,6 +405,17 @@ public:
     bool isDefinedIP4();
 
     void purgeAllResponsesRead();
+
+    // Drains the modem stream without blocking and handles all complete lines as URCs.
+    // Call this from the main loop. Returns true if any line was handled.
+    bool poll();
+
+    // Registers a handler for the URCs with the given token (e.g. "+CEREG" or "+UUPSMR").
+    // The token string must stay valid. Handlers are also called for URCs the driver handles itself.
+    // The reply of a command run with execCommand() is not taken for a URC, so execCommand("AT+CEREG?", ...)
+    // still gets its "+CEREG: " line. Use a prefix when reading such replies with readResponse() directly.
+    // Returns false if all SODAQ_R4X_MAX_URC_HANDLERS slots are in use.
+    bool setURCHandler(const char* token, URCHandlerPtr handler);
     bool setApn(const char* apn);
     bool setIndicationsActive(bool on);
     void setNetworkStatusLED(bool on) { _networkStatusLED = on; };
@@ -208,6 +423,30 @@ public:
     bool setRadioActive(bool on);
     bool setVerboseErrors(bool on);
 
+    // Returns the registration status of the last +CEREG URC (see 3GPP TS 27.007), or -1 if unknown.
+    int8_t getRegistrationStatus() const { return _registrationStatus; }
+
+
+    /******************************************************************************
+    * Power saving
+    *****************************************************************************/
+
+    // Requests power saving mode with the periodic TAU (T3412) and active time (T3324) in seconds.
+    // The network may grant other values, see getPowerSavingTimers(). A "tau" of 0 disables PSM.
+    // Applied by connect(), or right away if the modem is on.
+    bool setPowerSavingMode(uint32_t tau, uint32_t activeTime);
+
+    // Requests eDRX with the cycle and paging time window given as the 4-bit codes of 3GPP TS 24.008
+    // (e.g. cycle 0b0101 is 81.92 s for LTE-M). A cycle of EDRX_DISABLED disables eDRX.
+    // Applied by connect(), or right away if the modem is on.
+    bool setEdrx(uint8_t cycle, uint8_t pagingWindow, uint8_t actType = EDRX_ACT_LTEM);
+
+    // Queries the periodic TAU and active time granted by the network, in seconds (0 if not granted).
+    bool getPowerSavingTimers(uint32_t* tau, uint32_t* activeTime);
+
+    // Returns the state of the last +UUPSMR URC: 0 awake, 1 entering PSM, or -1 if unknown.
+    int8_t getPsmState() const { return _psmState; }
+
 
     /******************************************************************************
     * RSSI and CSQ
@@ -218,6 +457,30 @@ public:
 
     uint8_t getCSQtime()  const { return _CSQtime; }
     int8_t  getLastRSSI() const { return _lastRSSI; }
+
+    // Returns the last cell id reported by getCellInfo() or a +CEREG URC, or 0 if unknown.
+    uint32_t getLastCellId() const { return _lastCellId; }
+
+
+    /******************************************************************************
+    * Telemetry
+    *****************************************************************************/
+
+    // Records an operation that started at "startMillis" in the telemetry ring, together with the
+    // last RSSI and cell id, and adds it to the summary of the operation. The driver records attaches,
+    // socket connects, and MQTT logins and publishes over the modem's own MQTT client.
+    void recordTelemetry(uint8_t operation, uint32_t startMillis, bool success);
+
+    // Returns the number of records in the telemetry ring.
+    uint8_t getTelemetryCount() const { return _telemetryCount; }
+
+    // Returns the record at "index", the oldest one first, or NULL if there is no such record.
+    const TelemetryRecord* getTelemetryRecord(uint8_t index) const;
+
+    // Returns the summary of "operation" (TelemetryOperations), or NULL if there is no such operation.
+    const TelemetrySummary* getTelemetrySummary(uint8_t operation) const;
+
+    void clearTelemetry();
     int8_t  getMinRSSI()  const { return _minRSSI; }
 
     // Gets the Received Signal Strength Indication in dBm and Bit Error Rate.
@@ -239,7 +502,13 @@ public:
 
     // Required for TCP, optional for UDP (for UDP socketConnect() + socketWrite() == socketSend())
     bool   socketConnect(uint8_t socketID, const char* remoteHost, const uint16_t remotePort);
+    // Same as socketConnect() but does not block, see submitCommand().
+    uint8_t socketConnectAsync(uint8_t socketID, const char* remoteHost, const uint16_t remotePort,
+        CommandCallbackPtr callback, void* context = NULL);
     size_t socketWrite(uint8_t socketID, const uint8_t* buffer, size_t size);
+    // Same as socketWrite() for data in "count" parts, which are sent with one AT+USOWR as
+    // far as it goes (see SODAQ_R4X_MAX_SOCKET_BUFFER). Returns the number of bytes sent.
+    size_t socketWritev(uint8_t socketID, const SocketIoVec* iov, size_t count);
 
     // TCP only
     bool   socketWaitForRead(uint8_t socketID, uint32_t timeout = SODAQ_R4X_DEFAULT_READ_TIMOUT);
@@ -256,9 +525,23 @@ public:
     bool   socketIsClosed(uint8_t socketID);
     bool   socketWaitForClose(uint8_t socketID, uint32_t timeout);
 
+    // Returns the number of bytes to read from the socket, including the ones already in its receive buffer.
     size_t socketGetPendingBytes(uint8_t socketID);
     bool   socketHasPendingBytes(uint8_t socketID);
 
+    // Returns the sockets from "mask" (bit n for socket n) that have data to read or, for TCP, are closed.
+    // Handles URCs for up to "timeout" ms while none of them is ready.
+    uint8_t socketSelect(uint8_t mask, uint32_t timeout = 0);
+
+    // Returns the traffic counters of the socket, reset when the socket is created.
+    const SocketStats& socketGetStats(uint8_t socketID) const;
+
+    // Sets the data mode used by the socket read and write functions.
+    // Hex mode (default) sends every byte as two characters, binary mode sends the raw bytes.
+    // The mode is configured on the modem (AT+UDCONF=1) only when it differs from the last one set.
+    void   setSocketBinaryMode(bool on) { _socketBinaryMode = on; }
+    bool   isSocketBinaryMode() const { return _socketBinaryMode; }
+
 
     /******************************************************************************
     * MQTT
@@ -304,6 +587,19 @@ public:
     // Offset 0 is the byte directly after the HTTP Response header
     size_t httpGetPartial(uint8_t* buffer, size_t size, uint32_t offset);
 
+    // Passes the body of the previous HTTP Request to "handler", from "offset" on, in windows of
+    // at most SODAQ_R4X_HTTP_WINDOW_SIZE bytes. The header is skipped, so the body can be larger than RAM.
+    // Returns the number of bytes passed, which is less than the body size if reading failed or was stopped.
+    uint32_t httpReadBody(HttpBodyHandlerPtr handler, void* context = NULL, uint32_t offset = 0);
+
+    // Creates an HTTP request like httpRequest() and passes the response body to "handler" like httpReadBody().
+    // Returns true if the request succeeded, also with an empty body (e.g. 204 No Content). "delivered"
+    // (optional) is set to the number of bytes passed to the handler, as returned by httpReadBody().
+    bool httpRequestStream(const char* server, uint16_t port, const char* endpoint,
+                           HttpRequestTypes requestType, HttpBodyHandlerPtr handler, void* context = NULL,
+                           uint32_t* delivered = NULL, const char* sendBuffer = NULL, size_t sendSize = 0,
+                           uint32_t timeout = 60000, bool useURC = true);
+
     // Creates an HTTP POST request and optionally returns the received data.
     // Note. Endpoint should include the initial "/".
     // The UBlox device stores the received data in http_last_response_<profile_id>
@@ -337,6 +633,16 @@ public:
                        char* responseBuffer = NULL, size_t responseSize = 0,
                        const char* fileName = NULL, uint32_t timeout = 60000, bool useURC = true);
 
+    // Creates an HTTP request like httpRequestFromFile(), with a body appended to the modem file
+    // as "producer" generates it, so the body can be larger than RAM. The producer is called until
+    // a chunk of SODAQ_R4X_HTTP_UPLOAD_CHUNK_SIZE bytes is full, each chunk costs an AT+UDWNFILE.
+    // Fails (returns 0) without a request if the body is empty.
+    // Can only be used for POST and PUT requests
+    size_t httpRequestFromProducer(const char* server, uint16_t port, const char* endpoint,
+                                   HttpRequestTypes requestType, HttpBodyProducerPtr producer, void* context = NULL,
+                                   char* responseBuffer = NULL, size_t responseSize = 0,
+                                   uint32_t timeout = 60000, bool useURC = true);
+
     //  Paremeter index has a range [0-4]
     //  Parameters 'name' and 'value' can have a maximum length of 64 characters
     //  Parameters 'name' and 'value' must not include the ':' character
@@ -368,27 +674,198 @@ private:
     int8_t    _mqttLoginResult;
     int16_t   _mqttPendingMessages;
     int8_t    _mqttSubscribeReason;
+    int8_t    _psmState;
+    int8_t    _registrationStatus;
     bool      _networkStatusLED;
     char*     _pin;
     bool      _socketClosedBit[SOCKET_COUNT];
     size_t    _socketPendingBytes[SOCKET_COUNT];
+    bool      _socketIsUDP[SOCKET_COUNT];
+    SocketStats _socketStats[SOCKET_COUNT];
+
+    // Data read ahead from the TCP sockets (see fillSocketBuffers()), handed out first by socketRead().
+    struct SocketReceiveBuffer {
+        uint8_t  data[SODAQ_R4X_SOCKET_RX_BUFFER_SIZE];
+        uint16_t head;
+        uint16_t tail;
+    } _socketRxBuffer[SOCKET_COUNT];
+
+    bool      _socketBinaryMode;
+
+    // Last confirmed values of the modem settings, used to skip commands for values the modem already holds.
+    // Settings kept in the modem NVM (profile, URAT, band masks) survive a reboot, the others do not.
+    struct ConfigCache {
+        tribool_t psmDisabled;           // AT+CPSMS=0, or AT+CPSMS=1 with the timers below if false
+        uint32_t  psmTau;
+        uint32_t  psmActiveTime;
+        tribool_t psmUrcEnabled;         // AT+UPSMR=1
+        int8_t    ceregMode;             // AT+CEREG, -1 if unknown
+        int8_t    verboseErrors;         // AT+CMEE, -1 if unknown
+        int16_t   networkLEDMode;        // AT+UGPIOC mode of the network status GPIO, -1 if unknown
+        tribool_t echoOff;               // ATE0
+        tribool_t radioActive;           // AT+CFUN=1
+        tribool_t socketHexMode;         // AT+UDCONF=1
+        uint32_t  baudrate;              // AT+IPR, 0 if unknown
+        int16_t   mnoProfileRequested;   // The profile passed to checkProfile(), -1 if unknown
+        char      operatorSelect[8];     // AT+COPS manual selection, empty if unknown or automatic
+        char      urat[8];               // AT+URAT, empty if unknown
+        char      bandMaskLTE[24];       // AT+UBANDMASK, empty if unknown
+        char      bandMaskNB[24];
+    } _config;
+
+    // The parameters of the last connect(), used by reconnect().
+    struct ConnectParams {
+        const char* apn;
+        const char* urat;
+        uint8_t     mnoProfile;
+        const char* operatorSelect;
+        const char* bandMaskLTE;
+        const char* bandMaskNB;
+    } _lastConnect;
+
+    // The requested power saving settings, see setPowerSavingMode() and setEdrx().
+    uint32_t _psmTau;
+    uint32_t _psmActiveTime;
+    uint8_t  _edrxActType;   // 0 if eDRX was never requested
+    uint8_t  _edrxCycle;
+    uint8_t  _edrxPagingWindow;
 
     PublishHandlerPtr _mqttPublishHandler = NULL;
 
+    struct URCHandlerEntry {
+        const char*   token;
+        URCHandlerPtr handler;
+    };
+
+    URCHandlerEntry _urcHandlers[SODAQ_R4X_MAX_URC_HANDLERS];
+    uint8_t         _urcHandlerCount;
+
+    // The command execCommand() is waiting for, its reply is not dispatched as a URC.
+    const char* _execCommand;
+
+    struct QueuedCommand {
+        uint8_t            handle;
+        char               command[SODAQ_R4X_MAX_QUEUED_COMMAND_LENGTH];
+        const char*        prefix;
+        uint32_t           timeout;
+        int8_t             socketID;   // The socket opened by the command, or -1
+        CommandCallbackPtr callback;
+        void*              context;
+    };
+
+    // The queued commands, the first one is in progress when _commandStarted is set.
+    QueuedCommand _commandQueue[SODAQ_R4X_MAX_QUEUED_COMMANDS];
+    uint8_t       _commandCount;
+    uint8_t       _lastCommandHandle;
+    bool          _commandStarted;
+    bool          _sendingCommand;
+    uint32_t      _commandStartMillis;
+    char          _commandResponse[SODAQ_R4X_QUEUED_RESPONSE_SIZE];
+    size_t        _commandResponseSize;
+
+    // The command completed last, its callback is called once poll() is done.
+    uint8_t            _completedHandle;
+    GSMResponseTypes   _completedResult;
+    CommandCallbackPtr _completedCallback;
+    void*              _completedContext;
+
+    uint8_t queueCommand(const char* command, uint32_t timeout, CommandCallbackPtr callback,
+        void* context, const char* prefix, int8_t socketID);
+    bool handleCommandLine(char* line);
+    void completeCommand(GSMResponseTypes result);
+    void callCompletedCommand();
+    void flushCommands();
+
+    typedef bool (Sodaq_R4X::*URCMethodPtr)(const char* params);
+
+    struct URCTableEntry {
+        const char*  token;
+        URCMethodPtr method;
+    };
+
+    // The URCs handled by the driver, sorted by token.
+    static const URCTableEntry _urcTable[];
+
+    bool   onFOTAStatusURC(const char* params);
+    bool   onFunctionalityURC(const char* params);
+    bool   onHTTPErrorURC(const char* params);
+    bool   onHTTPResultURC(const char* params);
+    bool   onMQTTCommandURC(const char* params);
+    bool   onMQTTMessagesURC(const char* params);
+    bool   onPSMStateURC(const char* params);
+    bool   onRegistrationURC(const char* params);
+    bool   onSocketClosedURC(const char* params);
+    bool   onSocketDataURC(const char* params);
+
     int8_t checkApn(const char* requiredAPN); // -1: error, 0: ip not valid => need attach, 1: valid ip
     bool   checkBandMasks(const char* bandMaskLTE, const char* bandMaskNB);
     bool   checkCFUN();
+
+    // Retry delay of a polling loop, doubled after every wait up to "maxDelay".
+    struct Backoff {
+        uint32_t delay;
+        uint32_t maxDelay;
+    };
+
+    void   backoffWait(Backoff* backoff, const tribool_t* until = NULL);
+    bool   idleWait(uint32_t ms, const tribool_t* until = NULL);
+    void   idleSleep();
+    void   waitForPowerDown(uint32_t timeout);
+    int8_t queryRegistrationStatus();
+    bool   isContextActive();
+    bool   applyPowerSavingMode();
+    bool   setCeregMode(int8_t mode);
+    bool   applyEdrx();
     bool   checkCOPS(const char* requiredOperator, const char* requiredURAT);
     bool   checkProfile(uint8_t requiredProfile);
     bool   checkUrat(const char* requiredURAT);
+    bool   selectOperator(const char* requiredOperator, const char* requiredURAT);
+    bool   selectProfile(uint8_t requiredProfile);
+    bool   selectUrat(const char* requiredURAT);
+    bool   setEchoOff();
     bool   checkURC(char* buffer);
+    bool   isExecCommandReply(const char* line);
+    bool   checkSocketDataMode();
+    void   invalidateConfigCache(bool nvmSettings = true);
+    void   changeHostBaudrate(uint32_t baudrate);
+    bool   syncBaudrate(uint32_t timeout = ISALIVE_TIMEOUT);
+    bool   restoreBaudrate();
     bool   doSIMcheck();
     bool   setNetworkLEDState();
     bool   isValidIPv4(const char* str);
+    bool   parseModemIdentity(char* response, ModemIdentity* identity);
+    bool   copyIdentityField(bool valid, const char* field, char* buffer, size_t size);
 
     GSMResponseTypes readResponse(char* outBuffer = NULL, size_t outMaxSize = 0, const char* prefix = NULL,
                                   uint32_t timeout = DEFAULT_READ_MS);
 
+    // Reads a "+USORD: <id>,<len>,\"<data>\"" or "+USORF: <id>,\"<ip>\",<port>,<len>,\"<data>\"" response
+    // straight from the modem stream and decodes the data into "buffer" (up to "size" bytes).
+    // The data is hex encoded or raw (length framed), depending on the socket data mode.
+    // Other lines (URCs) are handled as in readResponse(). The final OK is consumed as well.
+    // Returns the number of bytes stored in "buffer" (the reported length, at most "size") and sets
+    // "socketID", or 0 on failure.
+    size_t readSocketData(const char* prefix, bool hasRemote, uint8_t* buffer, size_t size, int* socketID,
+                          uint32_t timeout = DEFAULT_READ_MS);
+
+    // Reads the data pending on the socket from the modem, leaving its receive buffer alone.
+    size_t socketReadModem(uint8_t socketID, uint8_t* buffer, size_t size);
+
+    // Moves the data pending on the open TCP sockets into their receive buffers, as far as it fits.
+    // Blocks for an AT+USORD per socket, so it is only called by the explicit waits, never by poll().
+    // The sockets in "skipMask" are left alone, the caller is about to read those itself.
+    void   fillSocketBuffers(uint8_t skipMask);
+
+    // Marks the socket closed and drops its pending data.
+    void   resetSocket(uint8_t socketID);
+
+    // Asks the modem for the number of bytes pending on the socket (AT+USORD or, for UDP, AT+USORF).
+    void   socketQueryPendingBytes(uint8_t socketID, bool udp);
+
+    // Handles URCs until the socket has pending bytes, sleeping in between, and queries the modem only
+    // after SODAQ_R4X_SOCKET_POLL_INTERVAL ms without any line. A TCP socket also stops waiting when it is closed.
+    bool   socketWaitForData(uint8_t socketID, bool udp, uint32_t timeout);
+
     void   reboot();
     bool   setSimPin(const char* simPin);
     bool   waitForSignalQuality(uint32_t timeout = 5L * 60L * 1000);
@@ -399,6 +876,7 @@ private:
     *****************************************************************************/
 
     static uint32_t convertDatetimeToEpoch(int y, int m, int d, int h, int min, int sec);
+    static uint8_t  parseIntFields(const char** str, int32_t* fields, uint8_t count);
     static bool startsWith(const char* pre, const char* str);
 
 
@@ -425,6 +903,11 @@ private:
     // The buffer used when reading from the modem. The space is allocated during init() via initBuffer().
     char* _inputBuffer;
 
+    // The ring the modem stream is drained into; lines are assembled from here.
+    uint8_t  _rxRing[SODAQ_R4X_RX_RING_SIZE];
+    uint16_t _rxHead;
+    uint16_t _rxTail;
+
     // This flag keeps track if the next write is the continuation of the current command
     // A Carriage Return will reset this flag.
     bool _appendCommand;
@@ -440,6 +923,18 @@ private:
     //   2..30          -109 to -53 dBm
     int8_t _lastRSSI;   // 0 not known or not detectable
 
+    // The cell id of the most recent getCellInfo() or +CEREG URC, 0 if not known
+    uint32_t _lastCellId;
+
+    ModemIdentity _identity;
+
+    // The telemetry records, _telemetryHead is the index of the next one to write.
+    TelemetryRecord _telemetry[SODAQ_R4X_TELEMETRY_SIZE];
+    uint8_t         _telemetryHead;
+    uint8_t         _telemetryCount;
+
+    TelemetrySummary _telemetrySummary[TelemetryOperationsMAX];
+
     // This is the number of second it took when CSQ was record last
     uint8_t _CSQtime;
 
@@ -450,6 +945,21 @@ private:
     // Keep track when connect started. Use this to record various status changes.
     uint32_t _startOn;
 
+    // The state of beginPowerOn() / pollPowerOn(), and when it entered it.
+    PowerOnStates _powerOnState;
+    uint32_t _powerOnStateMillis;
+    uint32_t _powerOnPulse;
+    uint32_t _powerOnProbeMillis;
+
+    // The baud rate requested with setBaudrate() and the one the stream is running at.
+    BaudrateChangeHandlerPtr _baudrateChangeHandler;
+    uint32_t _baudrate;
+    uint32_t _hostBaudrate;
+
+    // A rate that failed verification and that the modem may still be running at (AT+IPR is kept in NVM),
+    // tried by syncBaudrate(); 0 if none.
+    uint32_t _failedBaudrate;
+
     // Initializes the input buffer and makes sure it is only initialized once.
     // Safe to call multiple times.
     void initBuffer();
@@ -460,8 +970,15 @@ private:
     // Sets the modem stream.
     void setModemStream(Stream& stream);
 
+    // Moves everything the modem stream has available into the receive ring, as far as it fits.
+    // Returns the number of characters moved.
+    size_t fillRxRing();
+
+    // Returns true if the receive ring holds a line terminator or is full.
+    bool hasRxLine() const;
+
     // Returns a character from the modem stream if read within _timeout ms or -1 otherwise.
-    int timedRead(uint32_t timeout = 1000) const;
+    int timedRead(uint32_t timeout = 1000);
 
     // Fills the given "buffer" with characters read from the modem stream up to "length"
     // maximum characters and until the "terminator" character is found or a character read
@@ -475,6 +992,10 @@ private:
     // Returns the number of characters written to the buffer.
     size_t readBytes(uint8_t* buffer, size_t length, uint32_t timeout = 1000);
 
+    // Reads a decimal number from the modem stream, up to the "terminator" character.
+    // Returns false if a non-digit character is read or a character read times out.
+    bool readNumber(char terminator, uint32_t* value, uint32_t timeout = 1000);
+
     // Reads a line from the modem stream into the "buffer". The line terminator is not
     // written into the buffer. The buffer is terminated with null.
     // Returns the number of bytes read, not including the null terminator.
@@ -487,6 +1008,11 @@ private:
     // Write a byte
     size_t writeByte(uint8_t value);
 
+    // Writes the buffer as hex characters, encoded and sent in blocks instead of per character
+    // (see writeHexChunked() in Sodaq_HexWriter.h).
+    // Returns the number of characters written.
+    size_t writeHex(const uint8_t* buffer, size_t size);
+
     // Write the command prolog (just for debugging
     void writeProlog();
 
@@ -0,0 +1,276 @@
+#include "Sodaq_R4X_FileQueue.h"
+
+#define SEGMENT_HEADER_SIZE 2
+#define RECORD_HEADER_SIZE  2
+
+// True if sequence number "a" was handed out before "b", also across the wrap around.
+static inline bool isOlder(uint16_t a, uint16_t b)
+{
+    return (int16_t)(a - b) < 0;
+}
+
+void Sodaq_R4X_FileQueue::setR4Xinstance(Sodaq_R4X* r4xInstance, const char* prefix)
+{
+    _r4xInstance = r4xInstance;
+    _prefix = prefix;
+    _scanned = false;
+}
+
+bool Sodaq_R4X_FileQueue::push(const char* label, const uint8_t* data, size_t size)
+{
+    if (!label || (!data && size > 0) || !scan()) {
+        return false;
+    }
+
+    size_t labelLength = strlen(label) + 1;
+    size_t length = labelLength + size;
+
+    if (RECORD_HEADER_SIZE + length > SODAQ_R4X_QUEUE_MAX_RECORD_SIZE) {
+        return false;
+    }
+
+    int8_t slot = getWriteSlot(RECORD_HEADER_SIZE + length);
+
+    if (slot < 0) {
+        return false;
+    }
+
+    uint8_t record[SODAQ_R4X_QUEUE_MAX_RECORD_SIZE];
+
+    record[0] = length & 0xFF;
+    record[1] = (length >> 8) & 0xFF;
+    memcpy(record + RECORD_HEADER_SIZE, label, labelLength);
+    memcpy(record + RECORD_HEADER_SIZE + labelLength, data, size);
+
+    char filename[24];
+    getFilename(slot, filename, sizeof(filename));
+
+    if (!_r4xInstance->writeFile(filename, record, RECORD_HEADER_SIZE + length)) {
+        // part of the record may have been written, no more records go after it
+        uint32_t fileSize;
+        _size[slot] = _r4xInstance->getFileSize(filename, fileSize) ? fileSize : SODAQ_R4X_QUEUE_SEGMENT_SIZE;
+
+        return false;
+    }
+
+    _size[slot] += RECORD_HEADER_SIZE + length;
+
+    return true;
+}
+
+size_t Sodaq_R4X_FileQueue::replay(QueueRecordHandlerPtr handler, void* context, size_t maxRecords)
+{
+    if (!handler || !scan()) {
+        return 0;
+    }
+
+    int8_t slot = getOldestSlot();
+
+    if (slot < 0) {
+        return 0;
+    }
+
+    char filename[24];
+    getFilename(slot, filename, sizeof(filename));
+
+    // the records after the last acknowledged one are delivered (again)
+    if (_ackOffset < SEGMENT_HEADER_SIZE) {
+        _ackOffset = SEGMENT_HEADER_SIZE;
+    }
+    _readOffset = _ackOffset;
+
+    uint8_t record[SODAQ_R4X_QUEUE_MAX_RECORD_SIZE];
+    size_t delivered = 0;
+
+    while ((_readOffset < _size[slot]) && ((maxRecords == 0) || (delivered < maxRecords))) {
+        if (_r4xInstance->readFilePartial(filename, record, RECORD_HEADER_SIZE, _readOffset) != RECORD_HEADER_SIZE) {
+            return delivered; // try again later
+        }
+
+        size_t length = record[0] | (record[1] << 8);
+
+        if ((length == 0) || (length > sizeof(record)) || (_readOffset + RECORD_HEADER_SIZE + length > _size[slot])) {
+            // a truncated or corrupt record, the rest of the segment can't be trusted
+            _readOffset = _size[slot];
+            break;
+        }
+
+        if (_r4xInstance->readFilePartial(filename, record, length, _readOffset + RECORD_HEADER_SIZE) != length) {
+            return delivered;
+        }
+
+        size_t labelLength = strnlen((const char*)record, length);
+
+        if (labelLength < length) {
+            if (!handler((const char*)record, record + labelLength + 1, length - labelLength - 1, context)) {
+                return delivered;
+            }
+
+            delivered++;
+        }
+
+        _readOffset += RECORD_HEADER_SIZE + length;
+    }
+
+    return delivered;
+}
+
+void Sodaq_R4X_FileQueue::acknowledge()
+{
+    if (!_scanned) {
+        return;
+    }
+
+    int8_t slot = getOldestSlot();
+
+    if (slot < 0) {
+        return;
+    }
+
+    _ackOffset = _readOffset;
+
+    if (_ackOffset >= _size[slot]) {
+        deleteSegment(slot);
+    }
+}
+
+bool Sodaq_R4X_FileQueue::isEmpty()
+{
+    return !scan() || (getOldestSlot() < 0);
+}
+
+void Sodaq_R4X_FileQueue::clear()
+{
+    if (!_r4xInstance) {
+        return;
+    }
+
+    for (uint8_t slot = 0; slot < SODAQ_R4X_QUEUE_SEGMENTS; slot++) {
+        deleteSegment(slot);
+    }
+}
+
+// Finds the segments left by a previous run, once.
+bool Sodaq_R4X_FileQueue::scan()
+{
+    if (_scanned) {
+        return true;
+    }
+
+    if (!_r4xInstance || !_prefix || !_r4xInstance->isAlive()) {
+        return false;
+    }
+
+    bool first = true;
+
+    for (uint8_t slot = 0; slot < SODAQ_R4X_QUEUE_SEGMENTS; slot++) {
+        char filename[24];
+        getFilename(slot, filename, sizeof(filename));
+
+        uint32_t fileSize;
+        uint8_t header[SEGMENT_HEADER_SIZE];
+
+        _size[slot] = 0;
+
+        if (!_r4xInstance->getFileSize(filename, fileSize)) {
+            continue; // no such file
+        }
+
+        if ((fileSize <= SEGMENT_HEADER_SIZE) ||
+                (_r4xInstance->readFilePartial(filename, header, sizeof(header), 0) != sizeof(header))) {
+            _r4xInstance->deleteFile(filename);
+            continue;
+        }
+
+        _sequence[slot] = header[0] | (header[1] << 8);
+        _size[slot] = fileSize;
+
+        if (first || !isOlder(_sequence[slot], _nextSequence)) {
+            _nextSequence = _sequence[slot] + 1;
+            first = false;
+        }
+    }
+
+    _ackOffset = 0;
+    _readOffset = 0;
+    _scanned = true;
+
+    return true;
+}
+
+void Sodaq_R4X_FileQueue::getFilename(uint8_t slot, char* buffer, size_t size)
+{
+    snprintf(buffer, size, "%s%u", _prefix, slot);
+}
+
+int8_t Sodaq_R4X_FileQueue::getOldestSlot()
+{
+    int8_t oldest = -1;
+
+    for (uint8_t slot = 0; slot < SODAQ_R4X_QUEUE_SEGMENTS; slot++) {
+        if ((_size[slot] > 0) && ((oldest < 0) || isOlder(_sequence[slot], _sequence[oldest]))) {
+            oldest = slot;
+        }
+    }
+
+    return oldest;
+}
+
+// Returns the slot of the newest segment if the record still fits in it, otherwise starts a new segment,
+// in a free slot or in the one of the oldest segment, which is dropped.
+int8_t Sodaq_R4X_FileQueue::getWriteSlot(size_t recordSize)
+{
+    int8_t newest = -1;
+    int8_t target = -1;
+
+    for (uint8_t slot = 0; slot < SODAQ_R4X_QUEUE_SEGMENTS; slot++) {
+        if (_size[slot] == 0) {
+            if (target < 0) {
+                target = slot;
+            }
+        }
+        else if ((newest < 0) || isOlder(_sequence[newest], _sequence[slot])) {
+            newest = slot;
+        }
+    }
+
+    if ((newest >= 0) && (_size[newest] + recordSize <= SODAQ_R4X_QUEUE_SEGMENT_SIZE)) {
+        return newest;
+    }
+
+    if (target < 0) {
+        target = getOldestSlot();
+        deleteSegment(target);
+    }
+
+    char filename[24];
+    getFilename(target, filename, sizeof(filename));
+
+    uint8_t header[SEGMENT_HEADER_SIZE] = { (uint8_t)(_nextSequence & 0xFF), (uint8_t)(_nextSequence >> 8) };
+
+    _r4xInstance->deleteFile(filename); // cleanup the file first (if exists)
+
+    if (!_r4xInstance->writeFile(filename, header, sizeof(header))) {
+        return -1;
+    }
+
+    _sequence[target] = _nextSequence++;
+    _size[target] = sizeof(header);
+
+    return target;
+}
+
+void Sodaq_R4X_FileQueue::deleteSegment(uint8_t slot)
+{
+    char filename[24];
+    getFilename(slot, filename, sizeof(filename));
+
+    _r4xInstance->deleteFile(filename);
+
+    if (slot == getOldestSlot()) {
+        _ackOffset = 0;
+        _readOffset = 0;
+    }
+
+    _size[slot] = 0;
+}
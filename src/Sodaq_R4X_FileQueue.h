@@ -0,0 +1,82 @@
+#ifndef Sodaq_R4X_FileQueue_H
+#define Sodaq_R4X_FileQueue_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "Sodaq_R4X.h"
+
+// Persistent store-and-forward queue in the file system of the modem.
+//
+// Records are appended to a rotating set of segment files "<prefix><slot>". Each segment starts
+// with its sequence number (2 bytes) followed by the records: a 2 byte length, a NUL-terminated
+// label (e.g. the MQTT topic) and the data. The segments are replayed oldest first and each one
+// is deleted once all its records were acknowledged, see acknowledge(). When all the segments are
+// full the oldest one is dropped. The queue survives a reset of the MCU and of the modem; after a
+// reset the records of a partly acknowledged segment are replayed again.
+
+// Number of segment files.
+#ifndef SODAQ_R4X_QUEUE_SEGMENTS
+#define SODAQ_R4X_QUEUE_SEGMENTS 4
+#endif
+
+// Size at which a segment is closed and the next one is started.
+#ifndef SODAQ_R4X_QUEUE_SEGMENT_SIZE
+#define SODAQ_R4X_QUEUE_SEGMENT_SIZE 4096
+#endif
+
+// Largest record (label, NUL and data); records are assembled on the stack.
+#ifndef SODAQ_R4X_QUEUE_MAX_RECORD_SIZE
+#define SODAQ_R4X_QUEUE_MAX_RECORD_SIZE 320
+#endif
+
+// Called with each replayed record. The data is only valid during the call.
+// Returns true if the record was delivered; false stops the replay at this record.
+typedef bool(*QueueRecordHandlerPtr)(const char* label, const uint8_t* data, size_t size, void* context);
+
+class Sodaq_R4X_FileQueue {
+public:
+    // Set R4X instance, "prefix" must stay valid and be at most 16 characters
+    void setR4Xinstance(Sodaq_R4X* r4xInstance, const char* prefix = "queue_");
+
+    // Appends a record, returns false if it could not be stored.
+    bool push(const char* label, const uint8_t* data, size_t size);
+
+    // Passes the records of the oldest segment to "handler", up to "maxRecords" (0 for all),
+    // starting after the last acknowledged one. Returns the number of records delivered.
+    size_t replay(QueueRecordHandlerPtr handler, void* context = NULL, size_t maxRecords = 0);
+
+    // Marks the records delivered by the last replay() as done, e.g. once the broker acknowledged
+    // them, and deletes the segment when all its records are done. Without it replay() passes the
+    // same records again.
+    void acknowledge();
+
+    // Returns true if there are no stored records.
+    bool isEmpty();
+
+    // Deletes all the segments.
+    void clear();
+
+private:
+    Sodaq_R4X* _r4xInstance = NULL;
+    const char* _prefix = NULL;
+
+    // Per slot: the sequence number and size of its segment (0 if there is none).
+    uint16_t _sequence[SODAQ_R4X_QUEUE_SEGMENTS] = {};
+    uint32_t _size[SODAQ_R4X_QUEUE_SEGMENTS] = {};
+    uint16_t _nextSequence = 0;
+
+    // The offset of the first record in the oldest segment that is not acknowledged yet,
+    // and of the next record replay() would deliver
+    uint32_t _ackOffset = 0;
+    uint32_t _readOffset = 0;
+
+    bool _scanned = false;
+
+    bool scan();
+    void getFilename(uint8_t slot, char* buffer, size_t size);
+    int8_t getOldestSlot();
+    int8_t getWriteSlot(size_t recordSize);
+    void deleteSegment(uint8_t slot);
+};
+
+#endif // Sodaq_R4X_FileQueue_H
@@ -62,13 +62,60 @@ bool Sodaq_R4X_MQTT::closeMQTT(bool switchOff)
 
 bool Sodaq_R4X_MQTT::sendMQTTPacket(uint8_t* pckt, size_t pckt_len)
 {
-    if (isAliveMQTT()) {
-        //_r4xInstance->execCommand("AT+USOGO=0,65535,8");
-        return (_r4xInstance->socketWrite(_socketID, pckt, pckt_len) > 0);
-        //&& (_r4xInstance->socketFlush(_socketID)));
+    if (!isAliveMQTT()) {
+        return false;
     }
 
-    return false;
+    // socketWrite() sends at most one USOWR worth, large packets take several
+    while (pckt_len > 0) {
+        size_t sent = _r4xInstance->socketWrite(_socketID, pckt, pckt_len);
+        if (sent == 0) {
+            return false;
+        }
+        pckt += sent;
+        pckt_len -= sent;
+    }
+
+    return true;
+}
+
+bool Sodaq_R4X_MQTT::sendMQTTPacketv(const MQTTIoVec * iov, size_t count)
+{
+    if (count > SODAQ_R4X_MQTT_MAX_IOV) {
+        return Sodaq_MQTT_Interface::sendMQTTPacketv(iov, count);
+    }
+
+    if (!isAliveMQTT()) {
+        return false;
+    }
+
+    SocketIoVec parts[SODAQ_R4X_MQTT_MAX_IOV];
+    size_t first = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        parts[i].data = iov[i].data;
+        parts[i].size = iov[i].len;
+    }
+
+    // Usually one USOWR, a packet larger than that continues where the previous one stopped
+    while (first < count) {
+        size_t sent = _r4xInstance->socketWritev(_socketID, &parts[first], count - first);
+        if (sent == 0) {
+            return false;
+        }
+
+        while ((first < count) && (sent >= parts[first].size)) {
+            sent -= parts[first].size;
+            first++;
+        }
+
+        if (first < count) {
+            parts[first].data += sent;
+            parts[first].size -= sent;
+        }
+    }
+
+    return true;
 }
 
 size_t Sodaq_R4X_MQTT::receiveMQTTPacket(uint8_t * pckt, size_t size, uint32_t timeout)
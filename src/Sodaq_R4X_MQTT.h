@@ -27,6 +27,11 @@
 #include "Sodaq_R4X.h"
 #include "Sodaq_MQTT_Interface.h"
 
+// The most parts sendMQTTPacketv() passes to the modem as they are, see Sodaq_R4X::socketWritev()
+#ifndef SODAQ_R4X_MQTT_MAX_IOV
+#define SODAQ_R4X_MQTT_MAX_IOV 6
+#endif
+
 class Sodaq_R4X_MQTT : public Sodaq_MQTT_Interface {
 public:
     // Set R4X instance
@@ -36,6 +41,7 @@ public:
     bool openMQTT(const char * server, uint16_t port = 1883);
     bool closeMQTT(bool switchOff=true);
     bool sendMQTTPacket(uint8_t * pckt, size_t len);
+    bool sendMQTTPacketv(const MQTTIoVec * iov, size_t count);
     size_t receiveMQTTPacket(uint8_t * pckt, size_t size, uint32_t timeout = 20000);
     size_t availableMQTTPacket();
     bool isAliveMQTT();